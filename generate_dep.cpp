@@ -0,0 +1,399 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+/*
+Seeded generator of dependency graphs for main_cleaned.cpp, for scaling
+tests and reproducible benchmarks. generate_dep.py draws at most 4 edges per
+letter A-Z; this one writes millions of edges per second over any number of
+nodes, from one of several models:
+
+```
+g++ -std=c++17 -O2 generate_dep.cpp -o generate_dep
+./generate_dep --model=powerlaw --nodes=1000000 --edges=5000000 --seed=7 --output=big.txt
+```
+
+- `er`: `--edges` distinct edges between uniformly random nodes (Erdős–Rényi
+  G(n, m)); the drawn edges are kept in memory to avoid repeats.
+- `powerlaw`: out-degrees drawn from a power law of exponent `--alpha`, the
+  targets skewed towards a few popular nodes.
+- `layered`: `--layers` layers, each node depending on nodes of the next
+  layers only, so the graph is acyclic.
+- `chains`: chains of `--length` nodes, each node depending on the next.
+- `scc`: clusters of `--cluster` nodes with edges inside them drawn with
+  probability `--density`, and a few edges from each cluster to later ones.
+- `ecosystem`: packages added one at a time, each depending on packages added
+  before it, chosen in proportion to how many already use them; the first
+  are named `core/`, the next `lib/` and the rest `app/`.
+
+Nodes are named `n` and their number, zero padded to `--name-width` digits. `--format=binary` writes the
+binary edge list that main_cleaned.cpp also reads: the magic `GSEDGES1`, the
+node count and names, the edge count and the edges as two 32-bit node
+numbers and a 64-bit weight, all little-endian. `--max-weight=W` draws
+integer weights 1..W, written after the edge in text.
+*/
+
+// Buffered output, flushed in large blocks
+struct Writer {
+    std::FILE* file;
+    std::vector<char> buffer;
+
+    explicit Writer(std::FILE* f) : file(f) {
+        buffer.reserve(1 << 20);
+    }
+    ~Writer() {
+        flush();
+    }
+    void flush() {
+        std::fwrite(buffer.data(), 1, buffer.size(), file);
+        buffer.clear();
+    }
+    void put(const char* data, size_t size) {
+        if (buffer.size() + size > buffer.capacity()) {
+            flush();
+        }
+        buffer.insert(buffer.end(), data, data + size);
+    }
+    template <typename T>
+    void put_raw(T value) {
+        put(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+};
+
+// Fast uniform numbers below n
+struct Random {
+    std::mt19937_64 engine;
+
+    explicit Random(uint64_t seed) : engine(seed) {}
+
+    uint64_t below(uint64_t n) {
+        return (uint64_t)(((unsigned __int128)engine() * n) >> 64);
+    }
+    double unit() {
+        return (engine() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+struct Generator {
+    std::string model = "er";
+    uint64_t nodes = 1000, edges = 0;
+    double alpha = 2.1, density = 0.2;
+    uint64_t layers = 10, length = 100, cluster = 20, max_weight = 0;
+    int name_width = 0;
+    bool binary = false;
+
+    Random random{1};
+    Writer* out = nullptr;
+    uint64_t written = 0;
+    std::vector<uint32_t> from_list, to_list;   // kept for the binary format only
+    std::vector<double> weight_list;
+
+    // `n` and the zero padded number, or the tier prefix of the ecosystem
+    // model, formatted by hand: this is most of the work for text output
+    size_t name(uint64_t id, char* text) const {
+        const char* prefix = "n";
+        if (model == "ecosystem") {
+            prefix = id < nodes / 100 + 1 ? "core/" : id < nodes / 10 + 1 ? "lib/" : "app/";
+        }
+        size_t size = std::strlen(prefix);
+        std::memcpy(text, prefix, size);
+        char digits[24];
+        int count = 0;
+        do {
+            digits[count++] = '0' + id % 10;
+            id /= 10;
+        } while (id > 0);
+        for (int pad = count; pad < name_width; pad++) {
+            text[size++] = '0';
+        }
+        while (count > 0) {
+            text[size++] = digits[--count];
+        }
+        return size;
+    }
+
+    void edge(uint64_t from, uint64_t to) {
+        double weight = max_weight > 0 ? (double)(random.below(max_weight) + 1) : 1.0;
+        written++;
+        if (binary) {
+            from_list.push_back(from);
+            to_list.push_back(to);
+            weight_list.push_back(weight);
+            return;
+        }
+        char line[160];
+        size_t size = name(from, line);
+        std::memcpy(line + size, " -> ", 4);
+        size += 4;
+        size += name(to, line + size);
+        if (max_weight > 0) {
+            line[size++] = ' ';
+            size += std::snprintf(line + size, 24, "%llu", (unsigned long long)weight);
+        }
+        line[size++] = '\n';
+        out->put(line, size);
+    }
+
+    // A target other than `from`, uniform over the nodes
+    uint64_t other(uint64_t from) {
+        uint64_t to = random.below(nodes - 1);
+        return to >= from ? to + 1 : to;
+    }
+
+    // `edges` distinct edges: Floyd's sampling over the nodes * (nodes - 1)
+    // possible edges, numbered by source, one draw per edge; the drawn
+    // numbers are kept to reject repeats
+    void erdos_renyi() {
+        uint64_t possible = nodes * (nodes - 1);
+        std::unordered_set<uint64_t> drawn;
+        drawn.reserve(edges);
+        for (uint64_t j = possible - edges; j < possible; j++) {
+            uint64_t e = random.below(j + 1);
+            if (!drawn.insert(e).second) {
+                e = j;
+                drawn.insert(e);
+            }
+            uint64_t from = e / (nodes - 1), to = e % (nodes - 1);
+            edge(from, to >= from ? to + 1 : to);
+        }
+    }
+
+    // Out-degrees from a Pareto law scaled to the requested edge count on
+    // average; targets drawn as nodes * u^3, so low numbers are popular
+    void power_law() {
+        double mean = (double)edges / nodes;
+        double scale = mean * (alpha - 2.0) / (alpha - 1.0);
+        for (uint64_t from = 0; from < nodes; from++) {
+            double degree = scale / std::pow(1.0 - random.unit(), 1.0 / (alpha - 1.0));
+            uint64_t count = std::min<uint64_t>((uint64_t)degree + (random.unit() < degree - std::floor(degree)), nodes - 1);
+            for (uint64_t k = 0; k < count; k++) {
+                double u = random.unit();
+                uint64_t to = std::min<uint64_t>((uint64_t)(nodes * u * u * u), nodes - 1);
+                edge(from, to == from ? other(from) : to);
+            }
+        }
+    }
+
+    // Edges mostly to the next layer, sometimes further down
+    void layered() {
+        uint64_t width = std::max<uint64_t>(1, nodes / layers);
+        uint64_t per_node = std::max<uint64_t>(1, edges / std::max<uint64_t>(1, nodes - width));
+        for (uint64_t from = 0; from + width < nodes; from++) {
+            uint64_t layer = from / width;
+            for (uint64_t k = 0; k < per_node; k++) {
+                uint64_t skip = layer + 2 >= layers || random.unit() < 0.8 ? 1 : 1 + random.below(layers - layer - 1);
+                uint64_t first = (layer + skip) * width;
+                if (first >= nodes) {
+                    first = (layer + 1) * width;
+                }
+                edge(from, first + random.below(std::min(width, nodes - first)));
+            }
+        }
+    }
+
+    void chains() {
+        for (uint64_t from = 0; from + 1 < nodes; from++) {
+            if ((from + 1) % length != 0) {
+                edge(from, from + 1);
+            }
+        }
+    }
+
+    // Dense clusters, each a strongly connected component once a ring is
+    // laid through it, and sparse edges from a cluster to later ones
+    void clusters() {
+        for (uint64_t first = 0; first < nodes; first += cluster) {
+            uint64_t size = std::min(cluster, nodes - first);
+            for (uint64_t i = 0; i < size && size > 1; i++) {
+                edge(first + i, first + (i + 1) % size);
+                for (uint64_t j = 0; j < size; j++) {
+                    if (j != i && j != (i + 1) % size && random.unit() < density) {
+                        edge(first + i, first + j);
+                    }
+                }
+            }
+            if (first + size < nodes) {
+                for (int k = 0; k < 2; k++) {
+                    uint64_t to = first + size + random.below(nodes - first - size);
+                    edge(first + random.below(size), to);
+                }
+            }
+        }
+    }
+
+    // Preferential attachment over the packages added before, each package
+    // with about edges / nodes dependencies. `pool` holds one entry per
+    // package and one more per user, so a uniform pick favours popular ones.
+    void ecosystem() {
+        uint64_t per_node = std::max<uint64_t>(1, edges / nodes);
+        std::vector<uint32_t> pool;
+        for (uint64_t from = 0; from < nodes; from++) {
+            uint64_t count = std::min<uint64_t>(from, 1 + random.below(2 * per_node));
+            std::vector<uint32_t> chosen;
+            for (uint64_t k = 0; k < count; k++) {
+                uint32_t to = pool[random.below(pool.size())];
+                if (std::find(chosen.begin(), chosen.end(), to) == chosen.end()) {
+                    chosen.push_back(to);
+                }
+            }
+            for (uint32_t to : chosen) {
+                edge(from, to);
+                pool.push_back(to);
+            }
+            pool.push_back(from);
+        }
+    }
+
+    void run() {
+        if (model == "er") {
+            erdos_renyi();
+        } else if (model == "powerlaw") {
+            power_law();
+        } else if (model == "layered") {
+            layered();
+        } else if (model == "chains") {
+            chains();
+        } else if (model == "scc") {
+            clusters();
+        } else if (model == "ecosystem") {
+            ecosystem();
+        }
+        if (binary) {
+            out->put("GSEDGES1", 8);
+            out->put_raw<uint64_t>(nodes);
+            char text[80];
+            for (uint64_t id = 0; id < nodes; id++) {
+                size_t size = name(id, text);
+                out->put_raw<uint32_t>(size);
+                out->put(text, size);
+            }
+            out->put_raw<uint64_t>(from_list.size());
+            for (size_t e = 0; e < from_list.size(); e++) {
+                out->put_raw<uint32_t>(from_list[e]);
+                out->put_raw<uint32_t>(to_list[e]);
+                out->put_raw<double>(weight_list[e]);
+            }
+        }
+    }
+};
+
+// A whole non-negative decimal number, with no sign, garbage or overflow
+bool parse_count(const std::string& text, uint64_t& value) {
+    if (text.empty() || !std::isdigit((unsigned char)text[0])) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0' || parsed > UINT64_MAX) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// A whole finite decimal or floating number
+bool parse_real(const std::string& text, double& value) {
+    if (text.empty()) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return errno != ERANGE && *end == '\0' && std::isfinite(value);
+}
+
+int main(int argc, char* argv[]) {
+    std::unordered_map<std::string, std::string> options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0) {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+        options[arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2)] =
+            eq == std::string::npos ? "" : arg.substr(eq + 1);
+    }
+    // --key=N, or the fallback when it is missing; false after printing the
+    // problem when the value is not a number
+    auto count = [&](const std::string& key, uint64_t fallback, uint64_t& value) {
+        value = fallback;
+        if (options.count(key) && !parse_count(options[key], value)) {
+            std::cerr << "Invalid --" << key << ": " << options[key] << std::endl;
+            return false;
+        }
+        return true;
+    };
+    auto real = [&](const std::string& key, double fallback, double& value) {
+        value = fallback;
+        if (options.count(key) && !parse_real(options[key], value)) {
+            std::cerr << "Invalid --" << key << ": " << options[key] << std::endl;
+            return false;
+        }
+        return true;
+    };
+
+    Generator generator;
+    generator.model = options.count("model") ? options["model"] : "er";
+    uint64_t name_width, seed;
+    if (!count("nodes", 1000, generator.nodes)) {
+        return 1;
+    }
+    // 4 per node, or every possible edge on a few nodes
+    uint64_t capped = std::min<uint64_t>(generator.nodes, UINT32_MAX);
+    if (!count("edges", std::min<uint64_t>(4 * capped, capped * (capped - 1)), generator.edges) ||
+        !real("alpha", 2.1, generator.alpha) || !real("density", 0.2, generator.density) ||
+        !count("layers", 10, generator.layers) || !count("length", 100, generator.length) ||
+        !count("cluster", 20, generator.cluster) || !count("max-weight", 0, generator.max_weight) ||
+        !count("name-width", 0, name_width) || !count("seed", 1, seed)) {
+        return 1;
+    }
+    if (generator.nodes < 2 || generator.nodes > UINT32_MAX || generator.edges > generator.nodes * (generator.nodes - 1) ||
+        generator.alpha <= 2.0 || generator.density < 0.0 || generator.density > 1.0 ||
+        generator.max_weight > (1ULL << 53) || name_width > 40) {
+        std::cerr << "Need 2 <= --nodes < 2^32, --edges <= nodes * (nodes - 1), --alpha > 2, "
+                     "0 <= --density <= 1, --max-weight <= 2^53 and --name-width <= 40" << std::endl;
+        return 1;
+    }
+    generator.layers = std::max<uint64_t>(1, generator.layers);
+    generator.length = std::max<uint64_t>(1, generator.length);
+    generator.cluster = std::max<uint64_t>(1, generator.cluster);
+    generator.name_width = (int)name_width;
+    generator.binary = options["format"] == "binary";
+    generator.random = Random(seed);
+    const std::vector<std::string> models = {"er", "powerlaw", "layered", "chains", "scc", "ecosystem"};
+    if (std::find(models.begin(), models.end(), generator.model) == models.end()) {
+        std::cerr << "Unknown model: " << generator.model << " (er, powerlaw, layered, chains, scc, ecosystem)" << std::endl;
+        return 1;
+    }
+
+    std::string output = options.count("output") ? options["output"] : "dependencies.txt";
+    std::FILE* file = output == "-" ? stdout : std::fopen(output.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot write " << output << std::endl;
+        return 1;
+    }
+    {
+        Writer writer(file);
+        generator.out = &writer;
+        generator.run();
+    }
+    if (file != stdout) {
+        std::fclose(file);
+    }
+    std::cerr << "Wrote " << generator.written << " edges over " << generator.nodes << " nodes to " << output << std::endl;
+    return 0;
+}
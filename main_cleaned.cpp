@@ -6,6 +6,34 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <sstream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <cstdint>
+#include <cmath>
+#include <queue>
+#include <map>
+#include <list>
+#include <iterator>
+#include <regex>
+#include <memory>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 /*
 This code creats a set of dependency paths based on a input file that gives nodes and some connection to them in the form 
@@ -42,21 +70,83 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+// Limits for the path enumeration, 0 means no limit
+struct PathLimits {
+    size_t max_depth = 0;          // edges in a path
+    size_t max_paths_per_root = 0;
+    size_t max_total_paths = 0;
+    double time_budget = 0.0;      // seconds
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+    size_t root_paths = 0;         // paths stored for the present root
+    bool stopped = false;          // a count or time limit ended the search
+    std::vector<bool> truncated;   // parallel to all_paths
+    std::set<std::string> reasons; // limits that were hit
+};
+
+// Check the count and time limits, remember which one stopped the search
+bool limit_reached(PathLimits& limits, size_t total_paths) {
+    if (limits.stopped) {
+        return true;
+    }
+    limits.stopped = true;
+    if (limits.max_paths_per_root > 0 && limits.root_paths >= limits.max_paths_per_root) {
+        limits.reasons.insert("max paths per root");
+        return true;
+    }
+    if (limits.max_total_paths > 0 && total_paths >= limits.max_total_paths) {
+        limits.reasons.insert("max total paths");
+        return true;
+    }
+    if (limits.time_budget > 0.0) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - limits.start_time;
+        if (elapsed.count() >= limits.time_budget) {
+            limits.reasons.insert("time budget");
+            return true;
+        }
+    }
+    limits.stopped = false;
+    return false;
+}
+
+// Store a path, together with its truncated marker
+void store_path(const std::vector<std::string>& path,
+                std::vector<std::vector<std::string> >& all_paths,
+                PathLimits& limits, bool truncated) {
+    all_paths.push_back(path);
+    limits.truncated.push_back(truncated);
+    limits.root_paths++;
+}
+
 // Function to find all paths while tracking visited nodes
 void find_paths(const std::string& start, 
                const std::unordered_map<std::string, std::vector<std::string> >& adj_list, 
                std::vector<std::string>& path,
                std::unordered_set<std::string>& visited, 
                std::vector<std::vector<std::string> >& all_paths,
-               std::unordered_map<std::string, bool>& act_dep) {
+               std::unordered_map<std::string, bool>& act_dep,
+               PathLimits& limits) {
     
     // This will present starting new branch if the node is already in a tree
     act_dep[start]=false; 
 
+    // Stop if the count or time limits are reached. Running out of time
+    // leaves the present path unfinished, so it is stored as truncated.
+    if (limits.stopped) {
+        return;
+    }
+    if (limit_reached(limits, all_paths.size())) {
+        if (limits.reasons.count("time budget")) {
+            path.push_back(start);
+            store_path(path, all_paths, limits, true);
+        }
+        return;
+    }
+
     // Check if the node has been visited in the present call
     if(visited.find(start) != visited.end()) {
         path.push_back(start);
-        all_paths.push_back(path);
+        store_path(path, all_paths, limits, false);
         //path.pop_back(); //if no copies are used below
         return;
     }
@@ -65,19 +155,30 @@ void find_paths(const std::string& start,
     path.push_back(start);
     visited.insert(start);
 
+    // Store the path as truncated if it is too deep to continue
+    bool has_neighbors = adj_list.find(start) != adj_list.end();
+    if (has_neighbors && limits.max_depth > 0 && path.size() > limits.max_depth) {
+        limits.reasons.insert("max depth");
+        store_path(path, all_paths, limits, true);
+        return;
+    }
+
     // Start a search for each neighbour of the node
-    if (adj_list.find(start) != adj_list.end()) {
+    if (has_neighbors) {
         for (const std::string& neighbor : adj_list.at(start)) {
+             if (limits.stopped) {
+                 break;
+             }
              std::vector<std::string> new_path=path;
              std::unordered_set<std::string> new_visited=visited;
-             find_paths(neighbor, adj_list,new_path, new_visited, all_paths,act_dep);
+             find_paths(neighbor, adj_list,new_path, new_visited, all_paths,act_dep,limits);
             //find_paths(neighbor, adj_list,path, visited, all_paths,act_dep);
         }
     }
 
     // Store the path if this node is th last in the present path
-    if (adj_list.find(start) == adj_list.end()) {
-        all_paths.push_back(path);
+    if (!has_neighbors) {
+        store_path(path, all_paths, limits, false);
     }
 
     // Backtrack: remove current node from path and visited set. if no copies are used above
@@ -86,36 +187,465 @@ void find_paths(const std::string& start,
 }
 
 
-int main() {
+// Graph read from the dependency file
+struct DepGraph {
     std::vector<std::string> left_column;  // To store the left part
     std::vector<std::string> right_column; // To store the right part
-    std::ifstream file("dependencies.txt");
+    std::vector<double> weight_column;     // Optional cost of each edge, 1 if not given
+    std::unordered_map<std::string, std::vector<std::string> > adj_list;
+    std::unordered_map<std::string, std::vector<double> > adj_weight; // parallel to adj_list
+    std::unordered_map<std::string, std::vector<std::string> > rev_adj_list; // edges reversed
+    std::set<std::string> nodes;
+};
+
+// Rules selecting the nodes to read. A node is kept if it matches one of the
+// include rules (or there are none) and none of the exclude rules.
+struct NodeFilter {
+    std::vector<std::string> include_prefixes, exclude_prefixes;
+    std::vector<std::regex> include_patterns, exclude_patterns;
+
+    bool empty() const {
+        return include_prefixes.empty() && exclude_prefixes.empty() &&
+               include_patterns.empty() && exclude_patterns.empty();
+    }
+
+    bool keep(const std::string& name) const {
+        bool included = include_prefixes.empty() && include_patterns.empty();
+        for (size_t i = 0; i < include_prefixes.size() && !included; i++) {
+            included = name.compare(0, include_prefixes[i].size(), include_prefixes[i]) == 0;
+        }
+        for (size_t i = 0; i < include_patterns.size() && !included; i++) {
+            included = std::regex_search(name, include_patterns[i]);
+        }
+        if (!included) {
+            return false;
+        }
+        for (const std::string& prefix : exclude_prefixes) {
+            if (name.compare(0, prefix.size(), prefix) == 0) {
+                return false;
+            }
+        }
+        for (const std::regex& pattern : exclude_patterns) {
+            if (std::regex_search(name, pattern)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Parse a whole non-negative decimal number, rejecting signs, garbage and overflow
+bool parse_size(const std::string& text, size_t& value) {
+    if (text.empty() || !std::isdigit((unsigned char)text[0])) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0' || parsed > SIZE_MAX) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parse a whole non-negative decimal or floating number
+bool parse_number(const std::string& text, double& value) {
+    if (text.empty() || !(std::isdigit((unsigned char)text[0]) || text[0] == '.')) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return errno != ERANGE && *end == '\0' && std::isfinite(value);
+}
+
+// Read --name=N, or the default when it is missing. Prints the problem and
+// returns false when the value is not a number.
+bool parse_size_option(const std::unordered_map<std::string, std::string>& options, const std::string& name,
+                       size_t fallback, size_t& value) {
+    auto it = options.find(name);
+    value = fallback;
+    if (it != options.end() && !parse_size(it->second, value)) {
+        std::cerr << "Invalid --" << name << ": " << it->second << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parse_number_option(const std::unordered_map<std::string, std::string>& options, const std::string& name,
+                         double fallback, double& value) {
+    auto it = options.find(name);
+    value = fallback;
+    if (it != options.end() && !parse_number(it->second, value)) {
+        std::cerr << "Invalid --" << name << ": " << it->second << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Split a comma separated option value
+std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    std::istringstream list(value);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Binary edge list written by generate_dep --format=binary: the magic, the
+// node count and the names (32-bit length and bytes), the edge count and the
+// edges (two 32-bit node numbers and a 64-bit weight), little-endian
+bool read_binary_edges(std::ifstream& file, DepGraph& graph, const NodeFilter& filter) {
+    uint64_t count = 0;
+    std::vector<std::string> names;
+    if (!file.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        return false;
+    }
+    std::vector<bool> kept;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t size = 0;
+        if (!file.read(reinterpret_cast<char*>(&size), sizeof(size)) || size > (1 << 20)) {
+            return false;
+        }
+        std::string name(size, '\0');
+        if (!file.read(&name[0], size)) {
+            return false;
+        }
+        kept.push_back(filter.empty() || filter.keep(name));
+        names.push_back(name);
+    }
+    if (!file.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        return false;
+    }
+    for (uint64_t e = 0; e < count; e++) {
+        uint32_t from, to;
+        double weight;
+        if (!file.read(reinterpret_cast<char*>(&from), sizeof(from)) ||
+            !file.read(reinterpret_cast<char*>(&to), sizeof(to)) ||
+            !file.read(reinterpret_cast<char*>(&weight), sizeof(weight)) ||
+            from >= names.size() || to >= names.size()) {
+            return false;
+        }
+        if (kept[from] && kept[to]) {
+            graph.left_column.push_back(names[from]);
+            graph.right_column.push_back(names[to]);
+            graph.weight_column.push_back(weight);
+        }
+    }
+    return true;
+}
 
-    std::set<std::string> unique_values_left;
-    std::string s1,s2,s3;
+// Read the edges `A -> B` or `A -> B 3.5` from the file, or a binary edge
+// list. Edges with a node left out by the filter are dropped before their
+// names are stored.
+bool read_dependencies(const std::string& filename, DepGraph& graph,
+                       const NodeFilter& filter = NodeFilter()) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    char magic[8] = {};
+    if (file.read(magic, sizeof(magic)) && std::string(magic, sizeof(magic)) == "GSEDGES1") {
+        return read_binary_edges(file, graph, filter);
+    }
+    file.clear();
+    file.seekg(0);
 
-    // Read line by line from the file
-    while( file >> s1 >> s3 >>s2) { 
-        left_column.push_back(s1);
-        right_column.push_back(s2);
-        unique_values_left.insert(s1);
-    }    
+    std::string line, s1, s2, s3;
+    while (std::getline(file, line)) {
+        std::istringstream tokens(line);
+        if (!(tokens >> s1 >> s3 >> s2)) {
+            continue;
+        }
+        if (!filter.empty() && (!filter.keep(s1) || !filter.keep(s2))) {
+            continue;
+        }
+        double weight;
+        if (!(tokens >> weight)) {
+            weight = 1.0;
+        }
+        graph.left_column.push_back(s1);
+        graph.right_column.push_back(s2);
+        graph.weight_column.push_back(weight);
+    }
     file.close();
+    return true;
+}
 
-    // Collect all the unique value from the left side
-    std::vector<std::string> vleft(unique_values_left.begin(), unique_values_left.end());
+// Build the adjacency list, with the edge weights kept in the same order
+void build_adj_list(DepGraph& graph) {
+    // The keys are created in name order first, so the map is iterated in the
+    // same order as when it was filled node by node
+    std::set<std::string> unique_values_left(graph.left_column.begin(), graph.left_column.end());
+    for (const std::string& pstring : unique_values_left) {
+        graph.adj_list[pstring];
+        graph.adj_weight[pstring];
+    }
+    for (size_t j = 0; j < graph.left_column.size(); j++) {
+        graph.adj_list[graph.left_column[j]].push_back(graph.right_column[j]);
+        graph.adj_weight[graph.left_column[j]].push_back(graph.weight_column[j]);
+    }
+    for (size_t j = 0; j < graph.left_column.size(); j++) {
+        graph.rev_adj_list[graph.right_column[j]].push_back(graph.left_column[j]);
+    }
+    graph.nodes.insert(graph.left_column.begin(), graph.left_column.end());
+    graph.nodes.insert(graph.right_column.begin(), graph.right_column.end());
+}
 
-    //Build Adjancency List
-    std::unordered_map<std::string, std::vector<std::string> > adj_list;
-    for(int i=0;i<vleft.size();i++){
-        std:: string pstring= vleft[i];
-        for(int j=0; j<left_column.size();j++){
-            if(pstring== left_column[j]){
-                adj_list[pstring].push_back(right_column[j]);
+// Nodes numbered 0..n-1 in name order, for the algorithms that work on plain arrays
+struct NumberedGraph {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, int> index;
+    std::vector<std::vector<int> > out, in;
+    std::vector<std::vector<double> > weight; // parallel to out
+};
+
+// The names may hold more nodes than the graph, to number two graphs alike
+NumberedGraph number_graph(const DepGraph& graph, const std::set<std::string>& names) {
+    NumberedGraph g;
+    g.names.assign(names.begin(), names.end());
+    for (size_t i = 0; i < g.names.size(); i++) {
+        g.index[g.names[i]] = i;
+    }
+    g.out.resize(g.names.size());
+    g.in.resize(g.names.size());
+    g.weight.resize(g.names.size());
+    for (size_t j = 0; j < graph.left_column.size(); j++) {
+        int u = g.index[graph.left_column[j]], v = g.index[graph.right_column[j]];
+        g.out[u].push_back(v);
+        g.weight[u].push_back(graph.weight_column[j]);
+        g.in[v].push_back(u);
+    }
+    return g;
+}
+
+NumberedGraph number_graph(const DepGraph& graph) {
+    return number_graph(graph, graph.nodes);
+}
+
+// Tarjan's algorithm over the nodes in `inside` and the edges between them.
+// Iterative, so long chains do not overflow the stack.
+std::vector<std::vector<int> > tarjan_scc(const std::vector<int>& nodes,
+                                          const std::vector<std::vector<int> >& out,
+                                          const std::unordered_set<int>& inside) {
+    std::vector<std::vector<int> > components;
+    std::unordered_map<int, int> index, low;
+    std::unordered_set<int> on_stack;
+    std::vector<int> stack;
+    std::vector<std::pair<int, size_t> > calls; // node, next edge to look at
+    int counter = 0;
+
+    for (int root : nodes) {
+        if (index.count(root)) {
+            continue;
+        }
+        calls.push_back(std::make_pair(root, 0));
+        while (!calls.empty()) {
+            int n = calls.back().first;
+            size_t& e = calls.back().second;
+            if (e == 0 && !index.count(n)) {
+                index[n] = low[n] = counter++;
+                stack.push_back(n);
+                on_stack.insert(n);
+            }
+            if (e < out[n].size()) {
+                int m = out[n][e++];
+                if (!inside.count(m)) {
+                    continue;
+                }
+                if (!index.count(m)) {
+                    calls.push_back(std::make_pair(m, 0));
+                } else if (on_stack.count(m)) {
+                    low[n] = std::min(low[n], index[m]);
+                }
+                continue;
+            }
+            calls.pop_back();
+            if (!calls.empty()) {
+                int parent = calls.back().first;
+                low[parent] = std::min(low[parent], low[n]);
+            }
+            if (low[n] == index[n]) {
+                std::vector<int> component;
+                int m;
+                do {
+                    m = stack.back();
+                    stack.pop_back();
+                    on_stack.erase(m);
+                    component.push_back(m);
+                } while (m != n);
+                components.push_back(component);
+            }
+        }
+    }
+    return components;
+}
+
+// A component holds a cycle if it has several nodes, or one node depending on itself
+bool is_cyclic_component(const std::vector<int>& component, const std::vector<std::vector<int> >& out) {
+    int first = component[0];
+    return component.size() > 1 || std::find(out[first].begin(), out[first].end(), first) != out[first].end();
+}
+
+// The names of the nodes in name order, separated by spaces, as circular
+// components are printed
+std::string join_sorted_names(const std::vector<int>& nodes, const std::vector<std::string>& names) {
+    std::vector<std::string> sorted;
+    for (int node : nodes) {
+        sorted.push_back(names[node]);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    std::string joined;
+    for (const std::string& name : sorted) {
+        joined += (joined.empty() ? "" : " ") + name;
+    }
+    return joined;
+}
+
+// Strongly connected components of the whole graph
+std::vector<std::vector<int> > graph_scc(const NumberedGraph& g) {
+    std::vector<int> nodes(g.names.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i] = i;
+    }
+    std::unordered_set<int> inside(nodes.begin(), nodes.end());
+    return tarjan_scc(nodes, g.out, inside);
+}
+
+// Join the nodes of a path as `A -> B -> C`
+std::string path_to_string(const std::vector<std::string>& path) {
+    std::string out;
+    for (size_t i = 0; i < path.size(); i++) {
+        if (i > 0) {
+            out += " -> ";
+        }
+        out += path[i];
+    }
+    return out;
+}
+
+// Rotate a closed loop `B -> C -> A -> B` to start at its smallest node: `A -> B -> C -> A`
+std::vector<std::string> canonical_cycle(const std::vector<std::string>& loop) {
+    size_t n = loop.size() - 1;
+    size_t first = std::min_element(loop.begin(), loop.begin() + n) - loop.begin();
+    std::vector<std::string> cycle;
+    for (size_t i = 0; i <= n; i++) {
+        cycle.push_back(loop[(first + i) % n]);
+    }
+    return cycle;
+}
+
+// Occurrences of each cycle, in a hash map split in shards with a lock each,
+// so that several threads can count into it
+struct CycleCounter {
+    static const size_t shards = 64;
+    std::mutex locks[shards];
+    std::unordered_map<std::string, std::pair<size_t, size_t> > counts[shards]; // first index, count
+
+    void add(const std::string& cycle, size_t index) {
+        size_t shard = std::hash<std::string>()(cycle) % shards;
+        std::lock_guard<std::mutex> lock(locks[shard]);
+        auto it = counts[shard].find(cycle);
+        if (it == counts[shard].end()) {
+            counts[shard][cycle] = std::make_pair(index, 1);
+        } else {
+            it->second.first = std::min(it->second.first, index);
+            it->second.second++;
+        }
+    }
+
+    // The cycles with their counts, in the order they were first found
+    std::vector<std::pair<std::string, size_t> > in_order() const {
+        std::vector<std::pair<size_t, std::pair<std::string, size_t> > > all;
+        for (size_t shard = 0; shard < shards; shard++) {
+            for (const auto& entry : counts[shard]) {
+                all.push_back(std::make_pair(entry.second.first, std::make_pair(entry.first, entry.second.second)));
+            }
+        }
+        std::sort(all.begin(), all.end());
+        std::vector<std::pair<std::string, size_t> > result;
+        for (const auto& entry : all) {
+            result.push_back(entry.second);
+        }
+        return result;
+    }
+};
+
+// Paths of each root kept on disk between runs, one file per root named by
+// the hash of everything the root reaches (see subgraph_hashes) and the
+// limits that shape its paths. A root whose subgraph did not change loads
+// its paths instead of searching them again.
+struct PathCache {
+    std::string directory;
+    std::unordered_map<std::string, uint64_t> keys;   // root name -> file key
+    size_t hits = 0, misses = 0;
+
+    std::string file_name(uint64_t key) const {
+        std::ostringstream name;
+        name << directory << "/" << std::hex << key << ".paths";
+        return name.str();
+    }
+
+    // A file holds the root, then one path per line: a truncation flag and
+    // the nodes separated by spaces
+    bool load(const std::string& root, std::vector<std::vector<std::string> >& all_paths,
+              std::vector<bool>& truncated) {
+        auto key = keys.find(root);
+        std::ifstream file(key == keys.end() ? "" : file_name(key->second));
+        std::string line, first;
+        if (!file || !std::getline(file, first) || first != "root " + root) {
+            misses++;
+            return false;
+        }
+        while (std::getline(file, line)) {
+            std::istringstream tokens(line);
+            std::string flag, node;
+            tokens >> flag;
+            std::vector<std::string> path;
+            while (tokens >> node) {
+                path.push_back(node);
             }
+            all_paths.push_back(path);
+            truncated.push_back(flag == "t");
         }
+        hits++;
+        return true;
     }
 
+    void store(const std::string& root, const std::vector<std::vector<std::string> >& all_paths,
+               const std::vector<bool>& truncated, size_t first) const {
+        auto key = keys.find(root);
+        if (key == keys.end()) {
+            return;
+        }
+        std::string name = file_name(key->second), temporary = name + ".tmp";
+        std::ofstream file(temporary);
+        file << "root " << root << "\n";
+        for (size_t k = first; k < all_paths.size(); k++) {
+            file << (truncated[k] ? "t" : "c");
+            for (const std::string& node : all_paths[k]) {
+                file << " " << node;
+            }
+            file << "\n";
+        }
+        file.close();
+        if (!file || ::rename(temporary.c_str(), name.c_str()) != 0) {
+            ::unlink(temporary.c_str());
+        }
+    }
+};
+
+// Enumerate all paths and print them grouped by circular dependency. With a
+// cache, the roots whose subgraph is unchanged since it was filled are read
+// from it; the paths of the roots found first are the ones stored.
+int run_paths(const DepGraph& graph, PathLimits& limits, PathCache* cache = nullptr) {
+    const auto& adj_list = graph.adj_list;
+
     std::unordered_map<std::string, bool>act_dep;
     for (const auto& node : adj_list) {
         act_dep[node.first]=true;
@@ -125,42 +655,89 @@ int main() {
         if(act_dep[node.first]){
             std::vector<std::string> path;
             std::unordered_set<std::string> visited;
-            find_paths(node.first, adj_list, path, visited, all_paths,act_dep);
+            limits.root_paths = 0;
+            size_t first = all_paths.size();
+            if (cache && cache->load(node.first, all_paths, limits.truncated)) {
+                // Mark what the search would have, and keep its depth limit note
+                for (size_t k = first; k < all_paths.size(); k++) {
+                    for (const std::string& n : all_paths[k]) {
+                        act_dep[n] = false;
+                    }
+                    if (limits.truncated[k]) {
+                        limits.reasons.insert("max depth");
+                    }
+                }
+                continue;
+            }
+            find_paths(node.first, adj_list, path, visited, all_paths,act_dep,limits);
+            if (limits.reasons.count("max total paths") || limits.reasons.count("time budget")) {
+                break;
+            }
+            // A root stopped by its own path limit may have marked nodes that are
+            // on none of its paths, so it is not stored
+            if (cache && !limits.stopped) {
+                cache->store(node.first, all_paths, limits.truncated, first);
+            }
+            limits.stopped = false;
         }
     }
 
     // Print the found paths
     std::cout << "Paths found: " << all_paths.size()<< std::endl;
-    std::set<std::string> unique_paths;
-    std::vector<std::string> no_loop_paths, contain_loop_paths, is_loop_paths;
-    for(const auto & path : all_paths){
-        std::stringstream path_str;
-        std::unordered_set<std::string> unique_nodes;
-        bool is_loop = false; 
-        
-        // Check if a node in a path is present more than once
-        for (const std::string& node : path) {
-            if (unique_nodes.find(node) != unique_nodes.end()) {
-                is_loop = true;  
-            }
-            unique_nodes.insert(node);
-            path_str << node << " -> ";
-        }
-        
-        // Clasify the paths 
-        std::string path_output = path_str.str();
-        path_output = path_output.substr(0, path_output.size() - 4);
-        if (is_loop) {
-            if(path[0]==path[path.size()-1]){
-                is_loop_paths.push_back(path_output);
-            }else
-            {
-                contain_loop_paths.push_back(path_output);
+
+    // Clasify the paths, in parallel for large outputs. A closed loop is
+    // rotated to start at its smallest node, so the same cycle found from
+    // different starting nodes is counted once.
+    std::vector<char> kind(all_paths.size());
+    CycleCounter loops;
+    auto classify = [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; k++) {
+            const auto& path = all_paths[k];
+            std::unordered_set<std::string> unique_nodes;
+            bool is_loop = false;
+
+            // Check if a node in a path is present more than once
+            for (const std::string& node : path) {
+                if (unique_nodes.find(node) != unique_nodes.end()) {
+                    is_loop = true;
+                }
+                unique_nodes.insert(node);
             }
-        } else {
+
+            kind[k] = !is_loop ? 'n' : path[0] == path[path.size() - 1] ? 'i' : 'c';
+            if (kind[k] == 'i' && !limits.truncated[k]) {
+                loops.add(path_to_string(canonical_cycle(path)), k);
+            }
+        }
+    };
+    unsigned threads = all_paths.size() < 10000 ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.push_back(std::thread(classify, all_paths.size() * t / threads, all_paths.size() * (t + 1) / threads));
+    }
+    classify(0, all_paths.size() / threads);
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    std::vector<std::string> no_loop_paths, contain_loop_paths, is_loop_paths;
+    for(size_t k = 0; k < all_paths.size(); k++){
+        std::string path_output = path_to_string(all_paths[k]);
+        if (limits.truncated[k]) {
+            path_output += " [truncated]";
+        }
+        if (kind[k] == 'n') {
             no_loop_paths.push_back(path_output);
+        } else if (kind[k] == 'c') {
+            contain_loop_paths.push_back(path_output);
+        } else if (limits.truncated[k]) {
+            is_loop_paths.push_back(path_output);
         }
     }
+    for (const auto& loop : loops.in_order()) {
+        std::string times = loop.second == 1 ? " (1 occurrence)" : " (" + std::to_string(loop.second) + " occurrences)";
+        is_loop_paths.push_back(loop.first + times);
+    }
     
     //Print the paths based on containingg circular dependency or not
     std::cout << "No circular dependency" << std::endl;
@@ -176,5 +753,4141 @@ int main() {
         std::cout << ps << std::endl;
     }
 
+    if (limits.reasons.empty()) {
+        std::cout << "Output is complete" << std::endl;
+    } else {
+        std::cout << "Output is incomplete, limits reached:";
+        for (const std::string& reason : limits.reasons) {
+            std::cout << " " << reason << ";";
+        }
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
+
+// Order the nodes with Kahn's algorithm, leaving out the nodes in skip and
+// their edges first. Any other node on a cycle, or downstream of one, never
+// reaches in-degree zero and is left out too, so skip should hold every
+// cyclic node when the order has to be complete.
+void topological_order(const DepGraph& graph, std::vector<std::string>& topo_order,
+                       const std::unordered_set<std::string>& skip = std::unordered_set<std::string>()) {
+    std::unordered_map<std::string, int> in_degree;
+    for (const std::string& node : graph.nodes) {
+        in_degree[node] = 0;
+    }
+    for (size_t j = 0; j < graph.right_column.size(); j++) {
+        if (!skip.count(graph.left_column[j])) {
+            in_degree[graph.right_column[j]]++;
+        }
+    }
+
+    std::vector<std::string> ready;
+    for (const std::string& node : graph.nodes) {
+        if (in_degree[node] == 0 && !skip.count(node)) {
+            ready.push_back(node);
+        }
+    }
+    while (!ready.empty()) {
+        std::string node = ready.back();
+        ready.pop_back();
+        topo_order.push_back(node);
+        auto it = graph.adj_list.find(node);
+        if (it == graph.adj_list.end()) {
+            continue;
+        }
+        for (const std::string& neighbor : it->second) {
+            if (--in_degree[neighbor] == 0 && !skip.count(neighbor)) {
+                ready.push_back(neighbor);
+            }
+        }
+    }
+}
+
+// Longest weighted path starting at every node of the acyclic part of the graph.
+// The nodes on a cycle are found with Tarjan's algorithm and left out, and the
+// rest, including what lies downstream of a cycle, is relaxed in reverse
+// topological order, so each edge is looked at once. Edges into the cyclic
+// part are ignored.
+void critical_paths(const DepGraph& graph,
+                    std::vector<std::string>& topo_order,
+                    std::unordered_map<std::string, double>& cost,
+                    std::unordered_map<std::string, std::string>& next) {
+    NumberedGraph g = number_graph(graph);
+    std::unordered_set<std::string> cyclic;
+    for (const std::vector<int>& component : graph_scc(g)) {
+        if (is_cyclic_component(component, g.out)) {
+            for (int node : component) {
+                cyclic.insert(g.names[node]);
+            }
+        }
+    }
+    topological_order(graph, topo_order, cyclic);
+
+    for (auto node = topo_order.rbegin(); node != topo_order.rend(); ++node) {
+        cost[*node] = 0.0;
+        auto it = graph.adj_list.find(*node);
+        if (it == graph.adj_list.end()) {
+            continue;
+        }
+        const std::vector<double>& weights = graph.adj_weight.at(*node);
+        for (size_t i = 0; i < it->second.size(); i++) {
+            auto down = cost.find(it->second[i]);
+            if (down == cost.end()) {
+                continue; // edge into the cyclic part
+            }
+            double c = weights[i] + down->second;
+            if (next.find(*node) == next.end() || c > cost[*node]) {
+                cost[*node] = c;
+                next[*node] = it->second[i];
+            }
+        }
+    }
+}
+
+// Print the critical (most expensive) chain for every root of the graph
+int run_critical(const DepGraph& graph) {
+    std::vector<std::string> topo_order;
+    std::unordered_map<std::string, double> cost;
+    std::unordered_map<std::string, std::string> next;
+    critical_paths(graph, topo_order, cost, next);
+
+    std::unordered_set<std::string> has_parent(graph.right_column.begin(), graph.right_column.end());
+    std::vector<std::string> roots;
+    for (const std::string& node : graph.nodes) {
+        if (has_parent.find(node) == has_parent.end()) {
+            roots.push_back(node);
+        }
+    }
+    std::stable_sort(roots.begin(), roots.end(), [&](const std::string& a, const std::string& b) {
+        return cost[a] > cost[b];
+    });
+
+    std::cout << "Critical path per root:" << std::endl;
+    for (const std::string& root : roots) {
+        std::vector<std::string> chain(1, root);
+        for (auto it = next.find(root); it != next.end(); it = next.find(it->second)) {
+            chain.push_back(it->second);
+        }
+        std::cout << "[" << cost[root] << "] " << path_to_string(chain) << std::endl;
+    }
+    if (topo_order.size() < graph.nodes.size()) {
+        std::cout << "Nodes left out (on a cycle): "
+                  << graph.nodes.size() - topo_order.size() << std::endl;
+    }
+    return 0;
+}
+
+// Expand a BFS frontier by one level. Every predecessor at the previous level is
+// kept in parents, so all shortest paths can be rebuilt afterwards.
+void bfs_level(std::vector<std::string>& frontier,
+               const std::unordered_map<std::string, std::vector<std::string> >& adj,
+               std::unordered_map<std::string, int>& dist,
+               std::unordered_map<std::string, std::vector<std::string> >& parents) {
+    std::vector<std::string> next_frontier;
+    for (const std::string& node : frontier) {
+        auto it = adj.find(node);
+        if (it == adj.end()) {
+            continue;
+        }
+        for (const std::string& neighbor : it->second) {
+            auto d = dist.find(neighbor);
+            if (d == dist.end()) {
+                dist[neighbor] = dist[node] + 1;
+                next_frontier.push_back(neighbor);
+            } else if (d->second != dist[node] + 1) {
+                continue;
+            }
+            parents[neighbor].push_back(node);
+        }
+    }
+    frontier.swap(next_frontier);
+}
+
+// All the chains from node back to the BFS source, node first
+void trace_parents(const std::string& node,
+                   const std::unordered_map<std::string, std::vector<std::string> >& parents,
+                   std::vector<std::string>& path,
+                   std::vector<std::vector<std::string> >& out,
+                   bool all) {
+    path.push_back(node);
+    auto it = parents.find(node);
+    if (it == parents.end()) {
+        out.push_back(path);
+    } else {
+        for (const std::string& parent : it->second) {
+            trace_parents(parent, parents, path, out, all);
+            if (!all) {
+                break;
+            }
+        }
+    }
+    path.pop_back();
+}
+
+// Shortest chains from `from` to `to` with a bidirectional BFS: the forward
+// search runs on adj_list, the backward one on rev_adj_list, and the smaller
+// frontier is expanded first. When the searches meet, every shortest chain goes
+// through one of the nodes of the level just expanded.
+std::vector<std::vector<std::string> > shortest_chains(const DepGraph& graph,
+                                                      const std::string& from,
+                                                      const std::string& to,
+                                                      bool all) {
+    std::vector<std::vector<std::string> > chains;
+    if (from == to) {
+        chains.push_back(std::vector<std::string>(1, from));
+        return chains;
+    }
+
+    std::unordered_map<std::string, int> dist_f, dist_b;
+    std::unordered_map<std::string, std::vector<std::string> > parents_f, parents_b;
+    std::vector<std::string> frontier_f(1, from), frontier_b(1, to);
+    dist_f[from] = 0;
+    dist_b[to] = 0;
+
+    while (!frontier_f.empty() && !frontier_b.empty()) {
+        bool forward = frontier_f.size() <= frontier_b.size();
+        std::vector<std::string>& frontier = forward ? frontier_f : frontier_b;
+        std::unordered_map<std::string, int>& dist = forward ? dist_f : dist_b;
+        std::unordered_map<std::string, int>& other = forward ? dist_b : dist_f;
+        bfs_level(frontier, forward ? graph.adj_list : graph.rev_adj_list, dist,
+                  forward ? parents_f : parents_b);
+
+        int best = -1;
+        for (const std::string& node : frontier) {
+            auto o = other.find(node);
+            if (o != other.end() && (best < 0 || o->second < best)) {
+                best = o->second;
+            }
+        }
+        if (best < 0) {
+            continue;
+        }
+
+        for (const std::string& meet : frontier) {
+            auto o = other.find(meet);
+            if (o == other.end() || o->second != best) {
+                continue;
+            }
+            std::vector<std::string> path;
+            std::vector<std::vector<std::string> > heads, tails;
+            trace_parents(meet, parents_f, path, heads, all);
+            trace_parents(meet, parents_b, path, tails, all);
+            for (auto& head : heads) {
+                std::reverse(head.begin(), head.end());
+                for (const auto& tail : tails) {
+                    std::vector<std::string> chain = head;
+                    chain.insert(chain.end(), tail.begin() + 1, tail.end());
+                    chains.push_back(chain);
+                }
+            }
+            if (!all) {
+                break;
+            }
+        }
+        return chains;
+    }
+    return chains;
+}
+
+// Explain why `from` depends on `to` with the shortest chain(s) between them
+int run_why(const DepGraph& graph, const std::vector<std::string>& args, bool all) {
+    if (args.size() < 3) {
+        std::cerr << "Usage: why X Y [--all]" << std::endl;
+        return 1;
+    }
+    const std::string& from = args[1];
+    const std::string& to = args[2];
+    if (graph.nodes.find(from) == graph.nodes.end() || graph.nodes.find(to) == graph.nodes.end()) {
+        std::cerr << "Unknown node: " << (graph.nodes.count(from) ? to : from) << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<std::string> > chains = shortest_chains(graph, from, to, all);
+    if (chains.empty()) {
+        std::cout << from << " does not depend on " << to << std::endl;
+        return 0;
+    }
+    std::cout << "Shortest chains (length " << chains[0].size() - 1 << "): " << chains.size() << std::endl;
+    for (const auto& chain : chains) {
+        std::cout << path_to_string(chain) << std::endl;
+    }
     return 0;
 }
+
+// Nodes the path search starts from. Like act_dep in run_paths, a node of
+// adj_list is a root only if no earlier root reaches it. With a depth limit
+// the search stops max_depth edges below a root, so only the nodes that close
+// are marked, and the ones further down may start paths of their own.
+std::vector<std::string> traversal_roots(const DepGraph& graph, size_t max_depth = 0) {
+    std::vector<std::string> roots;
+    std::unordered_set<std::string> reached;
+    for (const auto& node : graph.adj_list) {
+        if (reached.find(node.first) != reached.end()) {
+            continue;
+        }
+        roots.push_back(node.first);
+        if (max_depth > 0) {
+            // Level by level, through nodes already marked by earlier roots too
+            std::unordered_set<std::string> seen;
+            std::vector<std::string> frontier(1, node.first);
+            seen.insert(node.first);
+            for (size_t depth = 0; depth <= max_depth && !frontier.empty(); depth++) {
+                std::vector<std::string> next_frontier;
+                for (const std::string& top : frontier) {
+                    reached.insert(top);
+                    auto it = graph.adj_list.find(top);
+                    if (depth == max_depth || it == graph.adj_list.end()) {
+                        continue;
+                    }
+                    for (const std::string& neighbor : it->second) {
+                        if (seen.insert(neighbor).second) {
+                            next_frontier.push_back(neighbor);
+                        }
+                    }
+                }
+                frontier.swap(next_frontier);
+            }
+            continue;
+        }
+        std::vector<std::string> stack(1, node.first);
+        reached.insert(node.first);
+        while (!stack.empty()) {
+            std::string top = stack.back();
+            stack.pop_back();
+            auto it = graph.adj_list.find(top);
+            if (it == graph.adj_list.end()) {
+                continue;
+            }
+            for (const std::string& neighbor : it->second) {
+                if (reached.insert(neighbor).second) {
+                    stack.push_back(neighbor);
+                }
+            }
+        }
+    }
+    return roots;
+}
+
+// What lies below a node, over all the paths from it down to the leaves. The
+// nodes of a circular component share one summary, with counts of -1. Plain
+// words only, so the array is stored as is in snapshots.
+struct SubtreeSummary {
+    double paths = 1.0;  // paths down to the leaves, -1 if a cycle is reachable
+    double nodes = 1.0;  // nodes summed over those paths
+    double bytes = 0.0;  // those paths printed as `A -> B`, without new lines
+    uint64_t depth = 0;  // longest chain below, a circular component counting as one step
+
+    bool reaches_cycle() const {
+        return paths < 0.0;
+    }
+};
+
+// Summary of a leaf node
+SubtreeSummary leaf_summary(const std::string& name) {
+    SubtreeSummary leaf;
+    leaf.bytes = name.size();
+    return leaf;
+}
+
+// One step of the summary DP: the summary of a component from those of the
+// components it depends on, which must be up to date. `comp` numbers the
+// component of every node.
+SubtreeSummary summarize_component(const NumberedGraph& g, const std::vector<int>& component, bool cyclic,
+                                   const std::vector<int>& comp, const std::vector<SubtreeSummary>& summary) {
+    int first = component[0];
+    SubtreeSummary below = leaf_summary(g.names[first]);
+    bool reaches_cycle = cyclic;
+    if (!g.out[first].empty()) {
+        below.paths = below.nodes = below.bytes = 0.0;
+    }
+    for (int u : component) {
+        for (int v : g.out[u]) {
+            if (comp[v] == comp[u]) {
+                continue;
+            }
+            const SubtreeSummary& s = summary[v];
+            below.depth = std::max(below.depth, s.depth + 1);
+            reaches_cycle = reaches_cycle || s.reaches_cycle();
+            below.paths += s.paths;
+            below.nodes += s.nodes + s.paths;
+            below.bytes += s.bytes + (g.names[u].size() + 4.0) * s.paths; // "X -> "
+        }
+    }
+    if (reaches_cycle) {
+        below.paths = below.nodes = below.bytes = -1.0;
+    }
+    return below;
+}
+
+// Summaries of all nodes in one pass over the condensation, successors first
+// (the order graph_scc lists the components in), instead of one traversal per root
+std::vector<SubtreeSummary> subtree_summaries(const NumberedGraph& g) {
+    std::vector<SubtreeSummary> summary(g.names.size());
+    std::vector<int> comp(g.names.size());
+    std::vector<std::vector<int> > components = graph_scc(g);
+    for (size_t c = 0; c < components.size(); c++) {
+        for (int node : components[c]) {
+            comp[node] = c;
+        }
+    }
+    for (const std::vector<int>& component : components) {
+        SubtreeSummary below = summarize_component(g, component, is_cyclic_component(component, g.out), comp, summary);
+        for (int u : component) {
+            summary[u] = below;
+        }
+    }
+    return summary;
+}
+
+// Size of a path enumeration, known before running it
+struct PathEstimate {
+    double paths = 0.0;
+    double nodes = 0.0;   // nodes summed over all paths
+    double bytes = 0.0;   // printed output
+    double memory = 0.0;  // all_paths plus the printed strings
+    bool exact = false;   // false: the numbers are upper bounds
+    bool bounded = true;  // false: no bound could be computed
+    std::unordered_map<std::string, double> root_paths;
+};
+
+// Estimate the output of run_paths without enumerating the paths.
+// On an acyclic graph the number of paths, nodes and bytes from every root
+// are those of its subtree summary. The counts are exact unless a depth
+// limit is given: paths cut at the same depth are then printed once, so the
+// full counts are an upper bound. With cycles the paths are bounded by the
+// walks of at most max_depth edges (the number of nodes if no depth is
+// given), counted level by level.
+PathEstimate estimate_paths(const DepGraph& graph, size_t max_depth) {
+    PathEstimate est;
+    std::vector<std::string> roots = traversal_roots(graph, max_depth);
+    NumberedGraph g = number_graph(graph);
+    std::vector<SubtreeSummary> summary = subtree_summaries(g);
+    bool acyclic = true;
+    for (const std::string& root : roots) {
+        acyclic = acyclic && !summary[g.index[root]].reaches_cycle();
+    }
+
+    if (acyclic) {
+        est.exact = max_depth == 0;
+        for (const std::string& root : roots) {
+            const SubtreeSummary& s = summary[g.index[root]];
+            est.root_paths[root] = s.paths;
+            est.paths += s.paths;
+            est.nodes += s.nodes;
+            est.bytes += s.bytes + s.paths; // new lines
+        }
+    } else {
+        // On the numbered graph a level is a pass over plain arrays
+        const std::vector<std::string>& names = g.names;
+        const std::vector<std::vector<int> >& children = g.out;
+
+        size_t levels = max_depth > 0 ? max_depth : names.size();
+        const double work_limit = 2e9; // edge visits
+        const double count_limit = 1e18;
+        if ((double)levels * graph.left_column.size() > work_limit) {
+            est.bounded = false;
+            return est;
+        }
+
+        // Walks with `level` edges from every node: count, nodes and bytes
+        std::vector<double> walks(names.size(), 1.0), nodes(names.size(), 1.0), bytes(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            bytes[i] = names[i].size();
+        }
+        for (size_t level = 0; ; level++) {
+            double total = 0.0;
+            for (const std::string& root : roots) {
+                size_t r = g.index[root];
+                est.root_paths[root] += walks[r];
+                est.paths += walks[r];
+                est.nodes += nodes[r];
+                est.bytes += bytes[r] + walks[r];
+                total += walks[r];
+            }
+            if (level == levels || total == 0.0 || est.paths > count_limit) {
+                break;
+            }
+            std::vector<double> w(names.size(), 0.0), n(names.size(), 0.0), b(names.size(), 0.0);
+            for (size_t i = 0; i < names.size(); i++) {
+                for (int c : children[i]) {
+                    w[i] += walks[c];
+                    n[i] += nodes[c];
+                    b[i] += bytes[c] + (names[i].size() + 4.0) * walks[c];
+                }
+                n[i] += w[i];
+            }
+            walks.swap(w);
+            nodes.swap(n);
+            bytes.swap(b);
+        }
+    }
+
+    // One vector and one printed string per path, one string per node
+    est.memory = est.paths * (sizeof(std::vector<std::string>) + sizeof(std::string) + 1)
+               + est.nodes * sizeof(std::string) + est.bytes;
+    return est;
+}
+
+// Print an estimate, with the per-root path counts if asked
+void print_estimate(const PathEstimate& est, bool per_root) {
+    if (!est.bounded) {
+        std::cout << "Path count has no bound that is cheap to compute, use --max-depth" << std::endl;
+        return;
+    }
+    const char* kind = est.exact ? "exact" : "upper bound";
+    std::cout << "Estimated paths: " << est.paths << " (" << kind << ")" << std::endl;
+    std::cout << "Estimated output bytes: " << est.bytes << " (" << kind << ")" << std::endl;
+    std::cout << "Estimated peak memory bytes: " << est.memory << " (" << kind << ")" << std::endl;
+    if (per_root) {
+        std::vector<std::pair<double, std::string> > roots;
+        for (const auto& root : est.root_paths) {
+            roots.push_back(std::make_pair(-root.second, root.first));
+        }
+        std::sort(roots.begin(), roots.end());
+        std::cout << "Paths per root:" << std::endl;
+        for (const auto& root : roots) {
+            std::cout << root.second << " " << -root.first << std::endl;
+        }
+    }
+}
+
+// Print the pre-flight estimate of the paths mode
+int run_estimate(const DepGraph& graph, size_t max_depth) {
+    print_estimate(estimate_paths(graph, max_depth), true);
+    return 0;
+}
+
+// Graph that keeps a topological order while edges are added one at a time,
+// using the Pearce-Kelly algorithm. An edge that would close a cycle is not
+// added; add_edge returns false and gives the cycle as a witness.
+struct DynamicGraph {
+    std::unordered_map<std::string, int> index;
+    std::vector<std::string> names;
+    std::vector<std::vector<int> > out, in;
+    std::vector<int> ord;     // position of each node in the topological order
+    std::vector<int> node_at; // node at each position
+
+    int node_id(const std::string& name) {
+        auto it = index.find(name);
+        if (it != index.end()) {
+            return it->second;
+        }
+        int id = names.size();
+        index[name] = id;
+        names.push_back(name);
+        out.push_back(std::vector<int>());
+        in.push_back(std::vector<int>());
+        ord.push_back(id);
+        node_at.push_back(id);
+        return id;
+    }
+
+    bool add_edge(const std::string& from, const std::string& to, std::vector<std::string>& cycle) {
+        int x = node_id(from), y = node_id(to);
+        cycle.clear();
+        if (x == y) {
+            cycle.push_back(from);
+            cycle.push_back(to);
+            return false;
+        }
+        if (ord[x] < ord[y]) {
+            out[x].push_back(y);
+            in[y].push_back(x);
+            return true;
+        }
+
+        // Only the nodes between ord[y] and ord[x] can be affected
+        int lower = ord[y], upper = ord[x];
+        std::vector<int> delta_f, delta_b;
+        std::unordered_map<int, int> parent;
+        std::vector<int> stack(1, y);
+        parent[y] = -1;
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            delta_f.push_back(n);
+            for (int m : out[n]) {
+                if (m == x) {
+                    // Witness: x -> y -> ... -> n -> x
+                    cycle.push_back(from);
+                    for (int k = n; k != -1; k = parent[k]) {
+                        cycle.insert(cycle.begin() + 1, names[k]);
+                    }
+                    cycle.push_back(from);
+                    return false;
+                }
+                if (ord[m] < upper && parent.find(m) == parent.end()) {
+                    parent[m] = n;
+                    stack.push_back(m);
+                }
+            }
+        }
+        std::unordered_set<int> seen_b;
+        stack.assign(1, x);
+        seen_b.insert(x);
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            delta_b.push_back(n);
+            for (int m : in[n]) {
+                if (ord[m] > lower && seen_b.insert(m).second) {
+                    stack.push_back(m);
+                }
+            }
+        }
+
+        // Give the affected positions to delta_b first, then delta_f
+        auto by_ord = [this](int a, int b) { return ord[a] < ord[b]; };
+        std::sort(delta_f.begin(), delta_f.end(), by_ord);
+        std::sort(delta_b.begin(), delta_b.end(), by_ord);
+        std::vector<int> nodes(delta_b);
+        nodes.insert(nodes.end(), delta_f.begin(), delta_f.end());
+        std::vector<int> slots;
+        for (int n : nodes) {
+            slots.push_back(ord[n]);
+        }
+        std::sort(slots.begin(), slots.end());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            ord[nodes[i]] = slots[i];
+            node_at[slots[i]] = nodes[i];
+        }
+
+        out[x].push_back(y);
+        in[y].push_back(x);
+        return true;
+    }
+};
+
+// Add the edges of the file one by one and report those that close a cycle
+int run_incremental(const DepGraph& graph) {
+    DynamicGraph dynamic;
+    size_t rejected = 0;
+    std::vector<std::string> cycle;
+    for (size_t j = 0; j < graph.left_column.size(); j++) {
+        if (!dynamic.add_edge(graph.left_column[j], graph.right_column[j], cycle)) {
+            rejected++;
+            std::cout << "Edge " << graph.left_column[j] << " -> " << graph.right_column[j]
+                      << " closes a cycle: " << path_to_string(cycle) << std::endl;
+        }
+    }
+    std::cout << "Edges added: " << graph.left_column.size() - rejected
+              << ", closing a cycle: " << rejected << std::endl;
+    return 0;
+}
+
+// Strongly connected components kept up to date while edges are added and
+// removed. Adding an edge between two components merges every component on a
+// path back from the head to the tail; removing an edge inside a component
+// reruns Tarjan on that component only.
+struct SccGraph {
+    // One entry of the change log
+    struct Change {
+        bool merged;             // false: split
+        std::vector<int> before; // component ids
+        std::vector<int> after;
+    };
+
+    std::unordered_map<std::string, int> index;
+    std::vector<std::string> names;
+    std::vector<std::vector<int> > out, in;
+    std::vector<int> comp;                                // component of each node
+    std::unordered_map<int, std::vector<int> > members;   // nodes of each component
+    std::unordered_map<int, int64_t> position;            // of each component in a topological order
+    std::vector<Change> changes;
+    int next_comp = 0;
+    int64_t next_position = 0;
+
+    int node_id(const std::string& name) {
+        auto it = index.find(name);
+        if (it != index.end()) {
+            return it->second;
+        }
+        int id = names.size();
+        index[name] = id;
+        names.push_back(name);
+        out.push_back(std::vector<int>());
+        in.push_back(std::vector<int>());
+        comp.push_back(next_comp);
+        position[next_comp] = next_position++;
+        members[next_comp++].push_back(id);
+        return id;
+    }
+
+    // Load a whole edge list at once, with one Tarjan pass for the starting
+    // components rather than one add_edge per edge
+    void seed(const DepGraph& graph) {
+        for (size_t j = 0; j < graph.left_column.size(); j++) {
+            int u = node_id(graph.left_column[j]), v = node_id(graph.right_column[j]);
+            out[u].push_back(v);
+            in[v].push_back(u);
+        }
+        std::vector<int> nodes(names.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            nodes[i] = i;
+        }
+        std::unordered_set<int> inside(nodes.begin(), nodes.end());
+        members.clear();
+        position.clear();
+        next_comp = 0;
+        std::vector<std::vector<int> > parts = tarjan_scc(nodes, out, inside);
+        next_position = parts.size();
+        for (const auto& part : parts) {
+            // Tarjan lists the successors first
+            int c = next_comp++;
+            for (int n : part) {
+                comp[n] = c;
+            }
+            members[c] = part;
+            position[c] = next_position - c - 1;
+        }
+    }
+
+    // Components reached from component `start` along `edges` without
+    // leaving the positions `low`..`high`
+    std::unordered_set<int> reach(int start, const std::vector<std::vector<int> >& edges,
+                                  int64_t low, int64_t high) const {
+        std::unordered_set<int> seen;
+        std::vector<int> stack(1, start);
+        seen.insert(start);
+        while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            for (int n : members.at(c)) {
+                for (int m : edges[n]) {
+                    int d = comp[m];
+                    int64_t p = position.at(d);
+                    if (p >= low && p <= high && seen.insert(d).second) {
+                        stack.push_back(d);
+                    }
+                }
+            }
+        }
+        return seen;
+    }
+
+    void add_edge(const std::string& from, const std::string& to) {
+        int u = node_id(from), v = node_id(to);
+        out[u].push_back(v);
+        in[v].push_back(u);
+        int cu = comp[u], cv = comp[v];
+        int64_t low = position[cv], high = position[cu];
+        if (cu == cv || high < low) {
+            return;
+        }
+
+        // The edge goes back in the order. Only the components placed between
+        // v's and u's can lie on a path from v to u; those both reached from v
+        // and reaching u close a cycle with the new edge.
+        std::unordered_set<int> forward = reach(cv, out, low, high);
+        std::unordered_set<int> backward = reach(cu, in, low, high);
+        std::vector<int64_t> slots;
+        std::vector<std::pair<int64_t, int> > before, merged, after;
+        for (int c : backward) {
+            slots.push_back(position[c]);
+            (forward.count(c) ? merged : before).push_back(std::make_pair(position[c], c));
+        }
+        for (int c : forward) {
+            if (!backward.count(c)) {
+                slots.push_back(position[c]);
+                after.push_back(std::make_pair(position[c], c));
+            }
+        }
+
+        // Reorder the two regions in their slots: what reaches u first, then
+        // what v reaches, each keeping its relative order (Pearce-Kelly)
+        std::sort(slots.begin(), slots.end());
+        std::sort(before.begin(), before.end());
+        std::sort(merged.begin(), merged.end());
+        std::sort(after.begin(), after.end());
+        size_t next = 0;
+        for (const auto& entry : before) {
+            position[entry.second] = slots[next++];
+        }
+        if (!merged.empty()) {
+            Change change;
+            change.merged = true;
+            for (const auto& entry : merged) {
+                change.before.push_back(entry.second);
+            }
+            std::sort(change.before.begin(), change.before.end());
+            int c = next_comp++;
+            for (int old : change.before) {
+                for (int n : members[old]) {
+                    comp[n] = c;
+                    members[c].push_back(n);
+                }
+                members.erase(old);
+                position.erase(old);
+            }
+            change.after.push_back(c);
+            changes.push_back(change);
+            position[c] = slots[next];
+            next += merged.size();
+        }
+        for (const auto& entry : after) {
+            position[entry.second] = slots[next++];
+        }
+    }
+
+    bool remove_edge(const std::string& from, const std::string& to) {
+        auto f = index.find(from), t = index.find(to);
+        if (f == index.end() || t == index.end()) {
+            return false;
+        }
+        int u = f->second, v = t->second;
+        auto e = std::find(out[u].begin(), out[u].end(), v);
+        if (e == out[u].end()) {
+            return false;
+        }
+        out[u].erase(e);
+        in[v].erase(std::find(in[v].begin(), in[v].end(), u));
+        if (comp[u] != comp[v]) {
+            return true;
+        }
+
+        // Only the component that held the edge can split
+        int old = comp[u];
+        std::vector<int> nodes = members[old];
+        std::unordered_set<int> inside(nodes.begin(), nodes.end());
+        std::vector<std::vector<int> > parts = tarjan_scc(nodes, out, inside);
+        if (parts.size() == 1) {
+            return true;
+        }
+        Change change;
+        change.merged = false;
+        change.before.push_back(old);
+        members.erase(old);
+
+        // The parts take the place of the old component, successors last;
+        // everything after it moves up to make room
+        int64_t first = position[old], extra = parts.size() - 1;
+        position.erase(old);
+        for (auto& entry : position) {
+            if (entry.second > first) {
+                entry.second += extra;
+            }
+        }
+        next_position += extra;
+        for (size_t k = 0; k < parts.size(); k++) {
+            int c = next_comp++;
+            for (int n : parts[k]) {
+                comp[n] = c;
+            }
+            members[c] = parts[k];
+            position[c] = first + extra - k;
+            change.after.push_back(c);
+        }
+        changes.push_back(change);
+        return true;
+    }
+
+    // Components with more than one node, or a node depending on itself
+    std::vector<std::vector<std::string> > cyclic_components() const {
+        std::vector<std::vector<std::string> > result;
+        for (const auto& m : members) {
+            if (!is_cyclic_component(m.second, out)) {
+                continue;
+            }
+            std::vector<std::string> component;
+            for (int k : m.second) {
+                component.push_back(names[k]);
+            }
+            std::sort(component.begin(), component.end());
+            result.push_back(component);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+};
+
+// Print the circular components and the log of merges and splits, after
+// the file and then after each update of `--updates=file` (`+ A -> B` or `- A -> B`)
+int run_scc(const DepGraph& graph, const std::string& updates) {
+    SccGraph scc;
+    scc.seed(graph);
+
+    size_t logged = 0;
+    auto print_state = [&](const std::string& title) {
+        std::cout << title << std::endl;
+        for (; logged < scc.changes.size(); logged++) {
+            const SccGraph::Change& change = scc.changes[logged];
+            std::cout << (change.merged ? "  merged" : "  split");
+            for (int c : change.before) {
+                std::cout << " #" << c;
+            }
+            std::cout << " into";
+            for (int c : change.after) {
+                std::cout << " #" << c;
+            }
+            std::cout << std::endl;
+        }
+        for (const auto& component : scc.cyclic_components()) {
+            std::cout << "  #" << scc.comp[scc.index.at(component[0])] << " {";
+            for (size_t k = 0; k < component.size(); k++) {
+                std::cout << (k ? " " : "") << component[k];
+            }
+            std::cout << "}" << std::endl;
+        }
+    };
+    print_state("Circular components:");
+
+    if (updates.empty()) {
+        return 0;
+    }
+    std::ifstream file(updates);
+    if (!file) {
+        std::cerr << "Cannot open " << updates << std::endl;
+        return 1;
+    }
+    std::string line, op, from, arrow, to;
+    for (size_t number = 1; std::getline(file, line); number++) {
+        std::istringstream tokens(line);
+        if (!(tokens >> op >> from >> arrow >> to)) {
+            continue;
+        }
+        if (op != "+" && op != "-") {
+            std::cerr << updates << ":" << number << ": unknown update '" << op << "', expected + or -" << std::endl;
+            return 1;
+        }
+        if (op == "+") {
+            scc.add_edge(from, to);
+        } else if (!scc.remove_edge(from, to)) {
+            std::cout << "No edge " << from << " -> " << to << std::endl;
+            continue;
+        }
+        print_state("After " + line + ":");
+    }
+    return 0;
+}
+
+// FNV-1a hash of some bytes, for file checksums and cache keys
+uint64_t checksum(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Merkle hash of what each node reaches, bottom up over the condensation: a
+// node's hash covers its name and the hashes of its successors in order, so
+// it changes exactly when something below it does. A circular component is
+// hashed as a whole, with its inner edges by name, and its nodes hash that
+// together with their own name.
+std::vector<uint64_t> subgraph_hashes(const NumberedGraph& g) {
+    std::vector<uint64_t> hash(g.names.size());
+    std::vector<int> comp(g.names.size());
+    std::vector<std::vector<int> > components = graph_scc(g);
+    for (size_t c = 0; c < components.size(); c++) {
+        for (int node : components[c]) {
+            comp[node] = c;
+        }
+    }
+    auto add_hash = [](std::string& text, uint64_t value) {
+        text.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    for (std::vector<int> component : components) {
+        std::sort(component.begin(), component.end());
+        std::string text;
+        for (int u : component) {
+            text += g.names[u] + '\n';
+            for (int v : g.out[u]) {
+                if (comp[v] == comp[u]) {
+                    text += "=" + g.names[v] + '\n';
+                } else {
+                    text += "#";
+                    add_hash(text, hash[v]);
+                }
+            }
+            text += '\n';
+        }
+        if (component.size() == 1) {
+            hash[component[0]] = checksum(text.data(), text.size());
+            continue;
+        }
+        uint64_t whole = checksum(text.data(), text.size());
+        for (int u : component) {
+            std::string own;
+            add_hash(own, whole);
+            own += g.names[u];
+            hash[u] = checksum(own.data(), own.size());
+        }
+    }
+    return hash;
+}
+
+// Edge suggested for removal, with the number of cycles that no other
+// suggested edge breaks, or the share of sampled cycles it breaks
+struct FeedbackArc {
+    int from, to;
+    double cycles;
+    bool sampled;
+};
+
+// Count the cycles through each feedback arc u -> v that use no other arc of
+// the set: the paths from v back to u in the component without the set.
+// `order` is a topological order of that acyclic remainder (local ids).
+// Returns false without counting if that would visit more than work_limit edges.
+bool count_broken_cycles(const std::vector<std::vector<int> >& dag,
+                         const std::vector<int>& order,
+                         std::vector<std::pair<int, int> >& arcs,
+                         std::vector<double>& cycles,
+                         double work_limit) {
+    std::vector<int> pos(order.size());
+    std::vector<double> edges_before(order.size() + 1, 0.0);
+    for (size_t i = 0; i < order.size(); i++) {
+        pos[order[i]] = i;
+        edges_before[i + 1] = edges_before[i] + dag[order[i]].size();
+    }
+
+    // Arcs with the same tail share one backward pass, from the tail down to
+    // the earliest head
+    std::sort(arcs.begin(), arcs.end());
+    std::vector<int> lowest(arcs.size());
+    double work = 0.0;
+    for (size_t a = arcs.size(); a-- > 0;) {
+        bool last = a + 1 == arcs.size() || arcs[a + 1].first != arcs[a].first;
+        lowest[a] = std::min(last ? pos[arcs[a].first] : lowest[a + 1], pos[arcs[a].second]);
+        if (a == 0 || arcs[a - 1].first != arcs[a].first) {
+            work += edges_before[pos[arcs[a].first]] - edges_before[lowest[a]];
+        }
+    }
+    if (work > work_limit) {
+        return false;
+    }
+
+    cycles.assign(arcs.size(), 0.0);
+    std::vector<double> paths(order.size());
+    for (size_t a = 0; a < arcs.size(); a++) {
+        int u = arcs[a].first;
+        if (a == 0 || arcs[a - 1].first != u) {
+            std::fill(paths.begin() + lowest[a], paths.begin() + pos[u] + 1, 0.0);
+            paths[u] = 1.0;
+            for (int i = pos[u] - 1; i >= lowest[a]; i--) {
+                double p = 0.0;
+                for (int m : dag[order[i]]) {
+                    if (pos[m] <= pos[u]) {
+                        p += paths[m];
+                    }
+                }
+                paths[order[i]] = p;
+            }
+        }
+        cycles[a] = paths[arcs[a].second];
+    }
+    return true;
+}
+
+// Share of random cycles that go through each feedback arc, for components
+// too large to count. A random walk inside the component closes a cycle as
+// soon as it comes back to a node.
+void sample_broken_cycles(const std::vector<std::vector<int> >& out,
+                          const std::vector<std::pair<int, int> >& arcs,
+                          std::vector<double>& cycles,
+                          size_t samples) {
+    std::vector<std::vector<size_t> > arcs_from(out.size());
+    for (size_t a = 0; a < arcs.size(); a++) {
+        arcs_from[arcs[a].first].push_back(a);
+    }
+    cycles.assign(arcs.size(), 0.0);
+    std::mt19937 random(1);
+    std::vector<size_t> seen_in(out.size(), samples), step(out.size());
+    std::vector<int> walk;
+    for (size_t s = 0; s < samples; s++) {
+        walk.clear();
+        int n = random() % out.size();
+        while (seen_in[n] != s) {
+            seen_in[n] = s;
+            step[n] = walk.size();
+            walk.push_back(n);
+            n = out[n][random() % out[n].size()];
+        }
+        walk.push_back(n);
+        for (size_t i = step[n]; i + 1 < walk.size(); i++) {
+            for (size_t a : arcs_from[walk[i]]) {
+                if (arcs[a].second == walk[i + 1]) {
+                    cycles[a] += 1.0 / samples;
+                }
+            }
+        }
+    }
+}
+
+// Kahn's order of a local graph, empty if it still has a cycle
+std::vector<int> local_topological_order(const std::vector<std::vector<int> >& dag) {
+    std::vector<int> in_degree(dag.size(), 0), order;
+    for (const auto& edges : dag) {
+        for (int m : edges) {
+            in_degree[m]++;
+        }
+    }
+    for (size_t n = 0; n < dag.size(); n++) {
+        if (in_degree[n] == 0) {
+            order.push_back(n);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int m : dag[order[i]]) {
+            if (--in_degree[m] == 0) {
+                order.push_back(m);
+            }
+        }
+    }
+    if (order.size() != dag.size()) {
+        order.clear();
+    }
+    return order;
+}
+
+// Small feedback arc set of one component with the Eades-Lin-Smyth heuristic.
+// Sinks are moved to the back of the order, sources to the front, and when
+// there are neither the node with the largest out-degree minus in-degree goes
+// to the front. The edges pointing backwards in that order form the set.
+// A local search then puts back every arc that closes no cycle on its own.
+std::vector<FeedbackArc> feedback_arcs(const NumberedGraph& g, const std::vector<int>& component) {
+    std::unordered_map<int, int> local;
+    for (size_t i = 0; i < component.size(); i++) {
+        local[component[i]] = i;
+    }
+    int n = component.size();
+    std::vector<std::vector<int> > out(n), in(n);
+    for (int i = 0; i < n; i++) {
+        for (int m : g.out[component[i]]) {
+            auto it = local.find(m);
+            if (it != local.end()) {
+                out[i].push_back(it->second);
+                in[it->second].push_back(i);
+            }
+        }
+    }
+
+    std::vector<int> out_degree(n), in_degree(n);
+    std::set<std::pair<int, int> > by_delta; // (in - out, node): smallest first
+    std::vector<int> sinks, sources;
+    std::vector<bool> removed(n, false);
+    for (int i = 0; i < n; i++) {
+        out_degree[i] = out[i].size();
+        in_degree[i] = in[i].size();
+        by_delta.insert(std::make_pair(in_degree[i] - out_degree[i], i));
+        if (out_degree[i] == 0) {
+            sinks.push_back(i);
+        } else if (in_degree[i] == 0) {
+            sources.push_back(i);
+        }
+    }
+
+    std::vector<int> front, back;
+    auto remove = [&](int r) {
+        removed[r] = true;
+        by_delta.erase(std::make_pair(in_degree[r] - out_degree[r], r));
+        for (int p : in[r]) {
+            if (removed[p]) {
+                continue;
+            }
+            by_delta.erase(std::make_pair(in_degree[p] - out_degree[p], p));
+            if (--out_degree[p] == 0) {
+                sinks.push_back(p);
+            }
+            by_delta.insert(std::make_pair(in_degree[p] - out_degree[p], p));
+        }
+        for (int m : out[r]) {
+            if (removed[m]) {
+                continue;
+            }
+            by_delta.erase(std::make_pair(in_degree[m] - out_degree[m], m));
+            if (--in_degree[m] == 0) {
+                sources.push_back(m);
+            }
+            by_delta.insert(std::make_pair(in_degree[m] - out_degree[m], m));
+        }
+    };
+    while (!by_delta.empty()) {
+        if (!sinks.empty()) {
+            int r = sinks.back();
+            sinks.pop_back();
+            if (!removed[r]) {
+                back.push_back(r);
+                remove(r);
+            }
+        } else if (!sources.empty()) {
+            int r = sources.back();
+            sources.pop_back();
+            if (!removed[r]) {
+                front.push_back(r);
+                remove(r);
+            }
+        } else {
+            int r = by_delta.begin()->second;
+            front.push_back(r);
+            remove(r);
+        }
+    }
+    front.insert(front.end(), back.rbegin(), back.rend());
+
+    std::vector<int> pos(n);
+    for (int i = 0; i < n; i++) {
+        pos[front[i]] = i;
+    }
+    std::vector<std::pair<int, int> > arcs;
+    std::vector<std::vector<int> > dag(n);
+    for (int i = 0; i < n; i++) {
+        for (int m : out[i]) {
+            if (pos[m] <= pos[i]) {
+                arcs.push_back(std::make_pair(i, m));
+            } else {
+                dag[i].push_back(m);
+            }
+        }
+    }
+
+    std::vector<double> cycles;
+    const double work_limit = 5e7; // edge visits
+    if (!count_broken_cycles(dag, front, arcs, cycles, work_limit)) {
+        sample_broken_cycles(out, arcs, cycles, 20000);
+        std::vector<FeedbackArc> result;
+        for (size_t a = 0; a < arcs.size(); a++) {
+            FeedbackArc arc = {component[arcs[a].first], component[arcs[a].second], cycles[a], true};
+            result.push_back(arc);
+        }
+        return result;
+    }
+
+    // An arc with no cycle of its own can go back if the remainder stays acyclic
+    bool put_back = false;
+    double work = 0.0;
+    for (size_t a = 0; a < arcs.size() && work < work_limit; a++) {
+        if (cycles[a] > 0.0 || arcs[a].first == arcs[a].second) {
+            continue;
+        }
+        std::vector<bool> seen(n, false);
+        std::vector<int> stack(1, arcs[a].second);
+        seen[arcs[a].second] = true;
+        while (!stack.empty() && !seen[arcs[a].first]) {
+            int r = stack.back();
+            stack.pop_back();
+            work += dag[r].size();
+            for (int m : dag[r]) {
+                if (!seen[m]) {
+                    seen[m] = true;
+                    stack.push_back(m);
+                }
+            }
+        }
+        if (!seen[arcs[a].first]) {
+            dag[arcs[a].first].push_back(arcs[a].second);
+            arcs[a].first = -1;
+            put_back = true;
+        }
+    }
+    // The counts of the first pass no longer line up with the smaller set
+    bool sampled = false;
+    if (put_back) {
+        arcs.erase(std::remove_if(arcs.begin(), arcs.end(),
+                                  [](const std::pair<int, int>& arc) { return arc.first < 0; }),
+                   arcs.end());
+        if (!count_broken_cycles(dag, local_topological_order(dag), arcs, cycles, work_limit * 2)) {
+            sample_broken_cycles(out, arcs, cycles, 20000);
+            sampled = true;
+        }
+    }
+
+    std::vector<FeedbackArc> result;
+    for (size_t a = 0; a < arcs.size(); a++) {
+        FeedbackArc arc = {component[arcs[a].first], component[arcs[a].second], cycles[a], sampled};
+        result.push_back(arc);
+    }
+    return result;
+}
+
+// Suggest the edges to cut so that no circular dependency is left. The
+// components are handled in parallel, the largest ones first.
+int run_feedback(const DepGraph& graph, unsigned threads) {
+    NumberedGraph g = number_graph(graph);
+    std::vector<std::vector<int> > components;
+    for (auto& component : graph_scc(g)) {
+        if (is_cyclic_component(component, g.out)) {
+            components.push_back(component);
+        }
+    }
+    std::sort(components.begin(), components.end(),
+              [](const std::vector<int>& a, const std::vector<int>& b) { return a.size() > b.size(); });
+
+    std::vector<std::vector<FeedbackArc> > results(components.size());
+    std::atomic<size_t> next_component(0);
+    auto worker = [&]() {
+        for (size_t c = next_component++; c < components.size(); c = next_component++) {
+            results[c] = feedback_arcs(g, components[c]);
+        }
+    };
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < components.size(); t++) {
+        pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    std::vector<FeedbackArc> arcs;
+    for (const auto& result : results) {
+        arcs.insert(arcs.end(), result.begin(), result.end());
+    }
+    std::stable_sort(arcs.begin(), arcs.end(), [](const FeedbackArc& a, const FeedbackArc& b) {
+        return a.sampled != b.sampled ? a.sampled < b.sampled : a.cycles > b.cycles;
+    });
+    std::cout << "Edges to remove: " << arcs.size() << " in " << components.size()
+              << " circular components" << std::endl;
+    for (const FeedbackArc& arc : arcs) {
+        if (arc.sampled) {
+            std::cout << "[" << 100.0 * arc.cycles << "% of sampled cycles] ";
+        } else {
+            std::cout << "[" << arc.cycles << " cycles] ";
+        }
+        std::cout << g.names[arc.from] << " -> " << g.names[arc.to] << std::endl;
+    }
+    return 0;
+}
+
+// Immediate dominators of the nodes reached from `root`, with the iterative
+// algorithm of Cooper, Harvey and Kennedy over the reverse postorder.
+// idom[root] == root, and -1 for the nodes not reached.
+std::vector<int> dominators(const std::vector<std::vector<int> >& out,
+                            const std::vector<std::vector<int> >& in,
+                            int root,
+                            std::vector<int>& rpo) {
+    int n = out.size();
+    std::vector<int> post_number(n, -1);
+    std::vector<bool> seen(n, false);
+    std::vector<std::pair<int, size_t> > calls(1, std::make_pair(root, 0));
+    std::vector<int> postorder;
+    seen[root] = true;
+    while (!calls.empty()) {
+        int node = calls.back().first;
+        size_t& e = calls.back().second;
+        if (e < out[node].size()) {
+            int m = out[node][e++];
+            if (!seen[m]) {
+                seen[m] = true;
+                calls.push_back(std::make_pair(m, 0));
+            }
+            continue;
+        }
+        post_number[node] = postorder.size();
+        postorder.push_back(node);
+        calls.pop_back();
+    }
+    rpo.assign(postorder.rbegin(), postorder.rend());
+
+    std::vector<int> idom(n, -1);
+    idom[root] = root;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (post_number[a] < post_number[b]) {
+                a = idom[a];
+            }
+            while (post_number[b] < post_number[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); i++) {
+            int b = rpo[i];
+            int new_idom = -1;
+            for (int p : in[b]) {
+                if (idom[p] == -1) {
+                    continue;
+                }
+                new_idom = new_idom == -1 ? p : intersect(p, new_idom);
+            }
+            if (idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// Print the immediate dominator of every node and how many nodes it
+// dominates. Without a root, a virtual root above the source components is used.
+int run_dominators(const DepGraph& graph, const std::vector<std::string>& args) {
+    NumberedGraph g = number_graph(graph);
+    int n = g.names.size();
+    int root;
+    if (args.size() > 1) {
+        auto it = g.index.find(args[1]);
+        if (it == g.index.end()) {
+            std::cerr << "Unknown node: " << args[1] << std::endl;
+            return 1;
+        }
+        root = it->second;
+    } else {
+        // The virtual root points at one node of every source component:
+        // each node with no dependents, and the first node of each cycle
+        // nothing outside depends on
+        std::vector<int> starts;
+        std::vector<int> comp(n);
+        std::vector<std::vector<int> > components = graph_scc(g);
+        for (size_t c = 0; c < components.size(); c++) {
+            for (int node : components[c]) {
+                comp[node] = c;
+            }
+        }
+        for (const auto& component : components) {
+            bool source = true;
+            for (int node : component) {
+                for (int p : g.in[node]) {
+                    source = source && comp[p] == comp[node];
+                }
+            }
+            if (source) {
+                starts.push_back(*std::min_element(component.begin(), component.end()));
+            }
+        }
+        std::sort(starts.begin(), starts.end());
+
+        root = n;
+        g.names.push_back("(root)");
+        g.out.push_back(std::vector<int>());
+        g.in.push_back(std::vector<int>());
+        g.weight.push_back(std::vector<double>());
+        for (int start : starts) {
+            g.out[root].push_back(start);
+            g.weight[root].push_back(0.0);
+            g.in[start].push_back(root);
+        }
+    }
+
+    std::vector<int> rpo;
+    std::vector<int> idom = dominators(g.out, g.in, root, rpo);
+    std::vector<int> size(g.names.size(), 1);
+    for (size_t i = rpo.size(); i-- > 1;) {
+        size[idom[rpo[i]]] += size[rpo[i]];
+    }
+
+    std::vector<int> order(rpo.begin() + 1, rpo.end());
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return size[a] > size[b]; });
+    std::cout << "Dominators from " << g.names[root] << " (" << rpo.size() - 1 << " nodes reached):" << std::endl;
+    for (int node : order) {
+        std::cout << g.names[node] << " <- " << g.names[idom[node]]
+                  << " (dominates " << size[node] - 1 << ")" << std::endl;
+    }
+    return 0;
+}
+
+// Nodes reached from any of the starts along the given edges
+std::vector<bool> reached_from(const std::vector<int>& starts, const std::vector<std::vector<int> >& edges) {
+    std::vector<bool> seen(edges.size(), false);
+    std::vector<int> stack;
+    for (int start : starts) {
+        if (!seen[start]) {
+            seen[start] = true;
+            stack.push_back(start);
+        }
+    }
+    while (!stack.empty()) {
+        int n = stack.back();
+        stack.pop_back();
+        for (int m : edges[n]) {
+            if (!seen[m]) {
+                seen[m] = true;
+                stack.push_back(m);
+            }
+        }
+    }
+    return seen;
+}
+
+std::vector<bool> reached_from(int start, const std::vector<std::vector<int> >& edges) {
+    return reached_from(std::vector<int>(1, start), edges);
+}
+
+// Simple cycles through `start`, at most max_cycles of them (0: all). Only
+// the component of start is searched: the nodes both reached from it and
+// reaching it. Without a length limit this is the circuit search of Johnson's
+// algorithm, where a node that cannot close a cycle stays blocked until one
+// of its successors is unblocked. With max_length (edges) the search is cut
+// where the remaining distance back to start is too long.
+std::vector<std::vector<int> > cycles_through(const NumberedGraph& g, int start,
+                                              size_t max_length, size_t max_cycles) {
+    std::vector<std::vector<int> > cycles;
+    std::vector<bool> forward = reached_from(start, g.out), backward = reached_from(start, g.in);
+    int n = g.names.size();
+    std::vector<std::vector<int> > out(n);
+    for (int i = 0; i < n; i++) {
+        if (!forward[i] || !backward[i]) {
+            continue;
+        }
+        for (int m : g.out[i]) {
+            if (forward[m] && backward[m]) {
+                out[i].push_back(m);
+            }
+        }
+    }
+
+    // Edges back to start from every node of the component
+    std::vector<size_t> dist(n, SIZE_MAX);
+    std::vector<int> queue(1, start);
+    dist[start] = 0;
+    for (size_t q = 0; q < queue.size(); q++) {
+        for (int p : g.in[queue[q]]) {
+            if (forward[p] && backward[p] && dist[p] == SIZE_MAX) {
+                dist[p] = dist[queue[q]] + 1;
+                queue.push_back(p);
+            }
+        }
+    }
+
+    std::vector<bool> blocked(n, false);
+    std::vector<std::vector<int> > blocked_by(n);
+    auto unblock = [&](int u) {
+        std::vector<int> stack(1, u);
+        while (!stack.empty()) {
+            int w = stack.back();
+            stack.pop_back();
+            if (!blocked[w]) {
+                continue;
+            }
+            blocked[w] = false;
+            stack.insert(stack.end(), blocked_by[w].begin(), blocked_by[w].end());
+            blocked_by[w].clear();
+        }
+    };
+
+    struct Frame {
+        int node;
+        size_t edge;
+        bool found;
+    };
+    std::vector<int> path(1, start);
+    std::vector<Frame> calls(1, Frame{start, 0, false});
+    blocked[start] = true;
+    while (!calls.empty()) {
+        if (max_cycles > 0 && cycles.size() >= max_cycles) {
+            break;
+        }
+        Frame& frame = calls.back();
+        int v = frame.node;
+        if (frame.edge < out[v].size()) {
+            int w = out[v][frame.edge++];
+            if (w == start) {
+                cycles.push_back(path);
+                cycles.back().push_back(start);
+                frame.found = true;
+            } else if (!blocked[w] && (max_length == 0 || path.size() + dist[w] <= max_length)) {
+                blocked[w] = true;
+                path.push_back(w);
+                calls.push_back(Frame{w, 0, false});
+            }
+            continue;
+        }
+
+        // All the successors are done
+        bool found = frame.found;
+        if (max_length > 0 || found) {
+            // With a length limit a node may close a cycle on a shorter path later
+            unblock(v);
+        } else {
+            for (int w : out[v]) {
+                if (std::find(blocked_by[w].begin(), blocked_by[w].end(), v) == blocked_by[w].end()) {
+                    blocked_by[w].push_back(v);
+                }
+            }
+        }
+        calls.pop_back();
+        path.pop_back();
+        if (!calls.empty() && found) {
+            calls.back().found = true;
+        }
+    }
+    return cycles;
+}
+
+// Print the simple cycles that go through one node
+int run_cycles_through(const DepGraph& graph, const std::vector<std::string>& args,
+                       size_t max_length, size_t max_cycles) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: cycles-through X [--max-length=N] [--max-cycles=N]" << std::endl;
+        return 1;
+    }
+    NumberedGraph g = number_graph(graph);
+    auto it = g.index.find(args[1]);
+    if (it == g.index.end()) {
+        std::cerr << "Unknown node: " << args[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<int> > cycles = cycles_through(g, it->second, max_length, max_cycles);
+    std::cout << "Cycles through " << args[1] << ": " << cycles.size();
+    if (max_cycles > 0 && cycles.size() >= max_cycles) {
+        std::cout << " (stopped at --max-cycles)";
+    }
+    std::cout << std::endl;
+    for (const auto& cycle : cycles) {
+        std::vector<std::string> names;
+        for (int node : cycle) {
+            names.push_back(g.names[node]);
+        }
+        std::cout << path_to_string(names) << std::endl;
+    }
+    return 0;
+}
+
+// Weighted distance from every node to `target`, by Dijkstra on the reversed edges
+std::vector<double> distances_to(const NumberedGraph& g, int target) {
+    std::vector<double> dist(g.names.size(), HUGE_VAL);
+    std::vector<std::vector<std::pair<int, double> > > rev(g.names.size());
+    for (size_t u = 0; u < g.out.size(); u++) {
+        for (size_t e = 0; e < g.out[u].size(); e++) {
+            rev[g.out[u][e]].push_back(std::make_pair(u, g.weight[u][e]));
+        }
+    }
+    typedef std::pair<double, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+    dist[target] = 0.0;
+    queue.push(Entry(0.0, target));
+    while (!queue.empty()) {
+        Entry top = queue.top();
+        queue.pop();
+        if (top.first > dist[top.second]) {
+            continue;
+        }
+        for (const auto& edge : rev[top.second]) {
+            double d = top.first + edge.second;
+            if (d < dist[edge.first]) {
+                dist[edge.first] = d;
+                queue.push(Entry(d, edge.first));
+            }
+        }
+    }
+    return dist;
+}
+
+// Cheapest path from `from` to `target` avoiding the banned nodes and the
+// banned successors of `from`. The distances of the full graph are a lower
+// bound once nodes and edges are taken away, so they guide an A* search.
+bool spur_path(const NumberedGraph& g, int from, int target,
+               const std::vector<double>& to_target,
+               const std::vector<bool>& banned,
+               const std::set<int>& banned_next,
+               std::vector<int>& path, double& cost) {
+    std::unordered_map<int, double> best;
+    std::unordered_map<int, int> parent;
+    typedef std::pair<double, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+    best[from] = 0.0;
+    queue.push(Entry(to_target[from], from));
+    while (!queue.empty()) {
+        Entry top = queue.top();
+        queue.pop();
+        int u = top.second;
+        double g_u = best[u];
+        if (top.first > g_u + to_target[u]) {
+            continue;
+        }
+        if (u == target) {
+            path.clear();
+            for (int n = target; n != from; n = parent[n]) {
+                path.push_back(n);
+            }
+            path.push_back(from);
+            std::reverse(path.begin(), path.end());
+            cost = g_u;
+            return true;
+        }
+        for (size_t e = 0; e < g.out[u].size(); e++) {
+            int v = g.out[u][e];
+            if (banned[v] || to_target[v] == HUGE_VAL || (u == from && banned_next.count(v))) {
+                continue;
+            }
+            double d = g_u + g.weight[u][e];
+            auto it = best.find(v);
+            if (it == best.end() || d < it->second) {
+                best[v] = d;
+                parent[v] = u;
+                queue.push(Entry(d + to_target[v], v));
+            }
+        }
+    }
+    return false;
+}
+
+// The k cheapest simple paths from `from` to `to`, with Yen's algorithm.
+// Each candidate leaves an earlier path at a spur node and continues on the
+// cheapest path that avoids the earlier ones; the distances to `to` are
+// computed once and reused by every spur search.
+std::vector<std::pair<double, std::vector<int> > > k_shortest_paths(const NumberedGraph& g,
+                                                                    int from, int to, size_t k) {
+    std::vector<std::pair<double, std::vector<int> > > found;
+    std::vector<double> to_target = distances_to(g, to);
+    std::vector<bool> banned(g.names.size(), false);
+    std::vector<int> path;
+    double cost;
+    if (!spur_path(g, from, to, to_target, banned, std::set<int>(), path, cost)) {
+        return found;
+    }
+    found.push_back(std::make_pair(cost, path));
+
+    // Edge weights along a path, to price the shared prefix of a candidate
+    auto edge_weight = [&](int u, int v) {
+        double w = HUGE_VAL;
+        for (size_t e = 0; e < g.out[u].size(); e++) {
+            if (g.out[u][e] == v) {
+                w = std::min(w, g.weight[u][e]);
+            }
+        }
+        return w;
+    };
+
+    std::set<std::pair<double, std::vector<int> > > candidates;
+    while (found.size() < k) {
+        const std::vector<int> previous = found.back().second;
+        double root_cost = 0.0;
+        for (size_t i = 0; i + 1 < previous.size(); i++) {
+            int spur = previous[i];
+            std::set<int> banned_next;
+            for (const auto& p : found) {
+                if (p.second.size() > i + 1 && std::equal(previous.begin(), previous.begin() + i + 1, p.second.begin())) {
+                    banned_next.insert(p.second[i + 1]);
+                }
+            }
+            for (size_t j = 0; j < i; j++) {
+                banned[previous[j]] = true;
+            }
+            if (spur_path(g, spur, to, to_target, banned, banned_next, path, cost)) {
+                std::vector<int> candidate(previous.begin(), previous.begin() + i);
+                candidate.insert(candidate.end(), path.begin(), path.end());
+                candidates.insert(std::make_pair(root_cost + cost, candidate));
+            }
+            for (size_t j = 0; j < i; j++) {
+                banned[previous[j]] = false;
+            }
+            root_cost += edge_weight(spur, previous[i + 1]);
+        }
+        if (candidates.empty()) {
+            break;
+        }
+        found.push_back(*candidates.begin());
+        candidates.erase(candidates.begin());
+    }
+    return found;
+}
+
+// Print the k cheapest alternative chains from X to Y
+int run_k_paths(const DepGraph& graph, const std::vector<std::string>& args, size_t k) {
+    if (args.size() < 3) {
+        std::cerr << "Usage: k-paths X Y [--k=N]" << std::endl;
+        return 1;
+    }
+    if (k == 0) {
+        std::cerr << "Invalid --k: 0" << std::endl;
+        return 1;
+    }
+    // The search assumes a path never gets cheaper as it grows
+    for (size_t j = 0; j < graph.weight_column.size(); j++) {
+        if (graph.weight_column[j] < 0.0) {
+            std::cerr << "Negative weight " << graph.weight_column[j] << " on " << graph.left_column[j]
+                      << " -> " << graph.right_column[j] << std::endl;
+            return 1;
+        }
+    }
+    NumberedGraph g = number_graph(graph);
+    if (!g.index.count(args[1]) || !g.index.count(args[2])) {
+        std::cerr << "Unknown node: " << (g.index.count(args[1]) ? args[2] : args[1]) << std::endl;
+        return 1;
+    }
+    auto paths = k_shortest_paths(g, g.index[args[1]], g.index[args[2]], k);
+    std::cout << "Cheapest chains from " << args[1] << " to " << args[2] << ": " << paths.size() << std::endl;
+    for (const auto& p : paths) {
+        std::vector<std::string> names;
+        for (int node : p.second) {
+            names.push_back(g.names[node]);
+        }
+        std::cout << "[" << p.first << "] " << path_to_string(names) << std::endl;
+    }
+    return 0;
+}
+
+// Printed paths from the given roots, as in the paths mode
+std::set<std::string> paths_from(const DepGraph& graph, const std::vector<std::string>& roots, PathLimits& limits) {
+    std::unordered_map<std::string, bool> act_dep;
+    std::vector<std::vector<std::string> > all_paths;
+    for (const std::string& root : roots) {
+        std::vector<std::string> path;
+        std::unordered_set<std::string> visited;
+        limits.root_paths = 0;
+        limits.stopped = false;
+        find_paths(root, graph.adj_list, path, visited, all_paths, act_dep, limits);
+    }
+    std::set<std::string> printed;
+    for (size_t k = 0; k < all_paths.size(); k++) {
+        printed.insert(path_to_string(all_paths[k]) + (limits.truncated[k] ? " [truncated]" : ""));
+    }
+    return printed;
+}
+
+// Circular components among the given nodes, as sorted name lists
+std::set<std::vector<std::string> > circular_components(const NumberedGraph& g, const std::vector<int>& nodes) {
+    std::set<std::vector<std::string> > result;
+    std::unordered_set<int> inside(nodes.begin(), nodes.end());
+    for (const auto& component : tarjan_scc(nodes, g.out, inside)) {
+        if (!is_cyclic_component(component, g.out)) {
+            continue;
+        }
+        std::vector<std::string> names;
+        for (int k : component) {
+            names.push_back(g.names[k]);
+        }
+        std::sort(names.begin(), names.end());
+        result.insert(names);
+    }
+    return result;
+}
+
+// Compare two dependency files. Both are numbered over one set of names, the
+// added and removed edges are listed, and only the part of the graphs around
+// them is analysed again: components are searched among the nodes reached from
+// a changed edge, and paths are enumerated from the roots that reach one.
+int run_diff(const std::vector<std::string>& args, PathLimits& limits, const NodeFilter& filter) {
+    if (args.size() < 3) {
+        std::cerr << "Usage: diff old new" << std::endl;
+        return 1;
+    }
+    DepGraph before, after;
+    for (int f = 0; f < 2; f++) {
+        if (!read_dependencies(args[f + 1], f ? after : before, filter)) {
+            std::cerr << "Cannot open " << args[f + 1] << std::endl;
+            return 1;
+        }
+    }
+    build_adj_list(before);
+    build_adj_list(after);
+    std::set<std::string> names(before.nodes);
+    names.insert(after.nodes.begin(), after.nodes.end());
+    NumberedGraph old_g = number_graph(before, names), new_g = number_graph(after, names);
+
+    // Changed edges, counting repeated lines
+    std::map<std::pair<int, int>, int> edge_count;
+    for (size_t u = 0; u < names.size(); u++) {
+        for (int v : new_g.out[u]) {
+            edge_count[std::make_pair(u, v)]++;
+        }
+        for (int v : old_g.out[u]) {
+            edge_count[std::make_pair(u, v)]--;
+        }
+    }
+    std::vector<std::pair<int, int> > added, removed;
+    for (const auto& edge : edge_count) {
+        if (edge.second > 0) {
+            added.push_back(edge.first);
+        } else if (edge.second < 0) {
+            removed.push_back(edge.first);
+        }
+    }
+    std::cout << "Edges added: " << added.size() << std::endl;
+    for (const auto& edge : added) {
+        std::cout << "+ " << new_g.names[edge.first] << " -> " << new_g.names[edge.second] << std::endl;
+    }
+    std::cout << "Edges removed: " << removed.size() << std::endl;
+    for (const auto& edge : removed) {
+        std::cout << "- " << old_g.names[edge.first] << " -> " << old_g.names[edge.second] << std::endl;
+    }
+
+    // Region reached from the changed edges in either graph; a component with
+    // one node in it lies in it completely
+    std::vector<int> tails;
+    for (const auto& edge : added) {
+        tails.push_back(edge.first);
+    }
+    for (const auto& edge : removed) {
+        tails.push_back(edge.first);
+    }
+    std::vector<bool> region(names.size(), false), ancestors(names.size(), false);
+    for (const NumberedGraph* g : {&old_g, &new_g}) {
+        std::vector<bool> down = reached_from(tails, g->out), up = reached_from(tails, g->in);
+        for (size_t i = 0; i < names.size(); i++) {
+            region[i] = region[i] || down[i];
+            ancestors[i] = ancestors[i] || up[i];
+        }
+    }
+    std::vector<int> region_nodes;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (region[i]) {
+            region_nodes.push_back(i);
+        }
+    }
+
+    std::set<std::vector<std::string> > old_cycles = circular_components(old_g, region_nodes);
+    std::set<std::vector<std::string> > new_cycles = circular_components(new_g, region_nodes);
+    auto print_components = [](const char* title, const std::set<std::vector<std::string> >& from,
+                               const std::set<std::vector<std::string> >& other) {
+        std::vector<std::vector<std::string> > listed;
+        for (const auto& component : from) {
+            if (!other.count(component)) {
+                listed.push_back(component);
+            }
+        }
+        std::cout << title << listed.size() << std::endl;
+        for (const auto& component : listed) {
+            std::cout << "{";
+            for (size_t k = 0; k < component.size(); k++) {
+                std::cout << (k ? " " : "") << component[k];
+            }
+            std::cout << "}" << std::endl;
+        }
+    };
+    print_components("Circular components new or changed: ", new_cycles, old_cycles);
+    print_components("Circular components gone or changed: ", old_cycles, new_cycles);
+
+    // Paths from the roots above a change
+    auto roots_above = [&](const DepGraph& graph) {
+        std::vector<std::string> roots;
+        for (const std::string& root : traversal_roots(graph)) {
+            if (ancestors[new_g.index[root]]) {
+                roots.push_back(root);
+            }
+        }
+        return roots;
+    };
+    PathLimits old_limits = limits;
+    std::set<std::string> old_paths = paths_from(before, roots_above(before), old_limits);
+    std::set<std::string> new_paths = paths_from(after, roots_above(after), limits);
+    std::vector<std::string> gained, lost;
+    std::set_difference(new_paths.begin(), new_paths.end(), old_paths.begin(), old_paths.end(),
+                        std::back_inserter(gained));
+    std::set_difference(old_paths.begin(), old_paths.end(), new_paths.begin(), new_paths.end(),
+                        std::back_inserter(lost));
+    std::cout << "Paths added: " << gained.size() << std::endl;
+    for (const std::string& p : gained) {
+        std::cout << "+ " << p << std::endl;
+    }
+    std::cout << "Paths removed: " << lost.size() << std::endl;
+    for (const std::string& p : lost) {
+        std::cout << "- " << p << std::endl;
+    }
+    limits.reasons.insert(old_limits.reasons.begin(), old_limits.reasons.end());
+    if (!limits.reasons.empty()) {
+        std::cout << "Path lists are incomplete, limits reached" << std::endl;
+    }
+    return 0;
+}
+
+#if defined(__cpp_impl_coroutine)
+// Paths produced on demand by a coroutine, for callers that only need the
+// first few. Each path is a view of the search stack and stays valid until
+// the next one is asked for; nothing runs once the caller stops asking.
+class PathGenerator {
+public:
+    struct promise_type {
+        const std::vector<std::string>* current = nullptr;
+
+        PathGenerator get_return_object() {
+            return PathGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const std::vector<std::string>& path) noexcept {
+            current = &path;
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+    };
+
+    struct iterator {
+        std::coroutine_handle<promise_type> handle;
+
+        const std::vector<std::string>& operator*() const { return *handle.promise().current; }
+        iterator& operator++() {
+            handle.resume();
+            return *this;
+        }
+        bool operator!=(std::default_sentinel_t) const { return !handle.done(); }
+    };
+
+    explicit PathGenerator(std::coroutine_handle<promise_type> h) : handle(h) {}
+    PathGenerator(PathGenerator&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    PathGenerator(const PathGenerator&) = delete;
+    ~PathGenerator() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    iterator begin() {
+        handle.resume();
+        return iterator{handle};
+    }
+    std::default_sentinel_t end() { return {}; }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+// The paths of find_paths, from the same roots, with an explicit stack so
+// that the coroutine can suspend between two paths. Memory does not depend
+// on the number of paths.
+PathGenerator generate_paths(const DepGraph& graph) {
+    const auto& adj_list = graph.adj_list;
+    std::unordered_set<std::string> reached; // act_dep of run_paths
+    std::vector<std::string> path;
+    std::unordered_set<std::string> on_path;
+    std::vector<std::pair<const std::vector<std::string>*, size_t> > frames; // neighbours, next one
+
+    for (const auto& node : adj_list) {
+        if (!reached.insert(node.first).second) {
+            continue;
+        }
+        path.assign(1, node.first);
+        on_path.insert(node.first);
+        frames.push_back(std::make_pair(&node.second, 0));
+        while (!frames.empty()) {
+            size_t top = frames.size() - 1;
+            if (frames[top].second == frames[top].first->size()) {
+                on_path.erase(path.back());
+                path.pop_back();
+                frames.pop_back();
+                continue;
+            }
+            const std::string& neighbor = (*frames[top].first)[frames[top].second++];
+            reached.insert(neighbor);
+            path.push_back(neighbor);
+            auto it = adj_list.find(neighbor);
+            if (on_path.count(neighbor) || it == adj_list.end()) {
+                co_yield path;
+                path.pop_back();
+                continue;
+            }
+            on_path.insert(neighbor);
+            frames.push_back(std::make_pair(&it->second, 0));
+        }
+    }
+}
+
+// Print the first n paths only
+int run_take(const DepGraph& graph, const std::vector<std::string>& args) {
+    size_t n = 10;
+    if (args.size() > 1 && !parse_size(args[1], n)) {
+        std::cerr << "Invalid count: " << args[1] << std::endl;
+        return 1;
+    }
+    size_t taken = 0;
+    if (n == 0) {
+        return 0;
+    }
+    for (const std::vector<std::string>& path : generate_paths(graph)) {
+        std::cout << path_to_string(path) << std::endl;
+        if (++taken == n) {
+            break;
+        }
+    }
+    return 0;
+}
+#else
+int run_take(const DepGraph&, const std::vector<std::string>&) {
+    std::cerr << "The take mode needs a C++20 build (-std=c++20)" << std::endl;
+    return 1;
+}
+#endif
+
+// One line of a dependency file, ordered so two files can be compared as sorted lists
+struct Edge {
+    std::string from, to;
+    double weight;
+
+    bool operator<(const Edge& other) const {
+        if (from != other.from) {
+            return from < other.from;
+        }
+        if (to != other.to) {
+            return to < other.to;
+        }
+        return weight < other.weight;
+    }
+    bool operator==(const Edge& other) const {
+        return from == other.from && to == other.to && weight == other.weight;
+    }
+};
+
+// Everything the daemon keeps in memory between queries. After an update
+// the adjacency lists of `graph` and `g` hold the edges; the columns of
+// `graph` keep the file as it was first read.
+struct AnalysisState {
+    DepGraph graph;
+    NumberedGraph g;
+    std::vector<Edge> edges;                   // sorted, to compare with a new file
+    std::vector<int> comp;                     // component of each node
+    std::vector<std::vector<int> > members;    // nodes of each component, empty once merged or split
+    std::vector<bool> comp_cyclic;             // component with a circular dependency
+    std::vector<std::unordered_map<int, int> > comp_out, comp_in; // condensation edges and their multiplicity
+    std::vector<SubtreeSummary> summary;       // of each node, see subtree_summaries
+    uint64_t version = 0;                      // changes whenever the graph does
+};
+
+// Recompute the subtree summaries of the given components and of every
+// component above them, and return those components. They are handled
+// successors first (post order of a search on the condensation), so each
+// summary is built from summaries that are up to date.
+std::vector<int> update_summaries(AnalysisState& state, const std::vector<int>& changed) {
+    std::vector<bool> seen_up(state.members.size(), false);
+    std::vector<int> stack;
+    for (int c : changed) {
+        if (!seen_up[c]) {
+            seen_up[c] = true;
+            stack.push_back(c);
+        }
+    }
+    std::vector<int> region;
+    while (!stack.empty()) {
+        int c = stack.back();
+        stack.pop_back();
+        region.push_back(c);
+        for (const auto& edge : state.comp_in[c]) {
+            if (!seen_up[edge.first]) {
+                seen_up[edge.first] = true;
+                stack.push_back(edge.first);
+            }
+        }
+    }
+
+    std::vector<bool> done(state.members.size(), false);
+    std::vector<int> order;
+    for (int root : region) {
+        if (done[root]) {
+            continue;
+        }
+        std::vector<std::pair<int, std::unordered_map<int, int>::const_iterator> > calls;
+        calls.push_back(std::make_pair(root, state.comp_out[root].begin()));
+        done[root] = true;
+        while (!calls.empty()) {
+            int c = calls.back().first;
+            auto& it = calls.back().second;
+            if (it != state.comp_out[c].end()) {
+                int d = (it++)->first;
+                if (seen_up[d] && !done[d]) {
+                    done[d] = true;
+                    calls.push_back(std::make_pair(d, state.comp_out[d].begin()));
+                }
+                continue;
+            }
+            order.push_back(c);
+            calls.pop_back();
+        }
+    }
+
+    for (int c : order) {
+        SubtreeSummary below = summarize_component(state.g, state.members[c], state.comp_cyclic[c], state.comp,
+                                                   state.summary);
+        for (int u : state.members[c]) {
+            state.summary[u] = below;
+        }
+    }
+    return order;
+}
+
+// Build the numbered graph, the components and their condensation, and the
+// subtree summary of every node
+void build_state(AnalysisState& state) {
+    state.g = number_graph(state.graph);
+    const NumberedGraph& g = state.g;
+    int n = g.names.size();
+    state.edges.clear();
+    for (size_t j = 0; j < state.graph.left_column.size(); j++) {
+        state.edges.push_back(Edge{state.graph.left_column[j], state.graph.right_column[j], state.graph.weight_column[j]});
+    }
+    std::sort(state.edges.begin(), state.edges.end());
+
+    std::vector<std::vector<int> > components = graph_scc(g);
+    state.members = components;
+    state.comp.assign(n, -1);
+    state.comp_cyclic.assign(components.size(), false);
+    for (size_t c = 0; c < components.size(); c++) {
+        for (int node : components[c]) {
+            state.comp[node] = c;
+        }
+        state.comp_cyclic[c] = is_cyclic_component(components[c], g.out);
+    }
+    state.comp_out.assign(components.size(), std::unordered_map<int, int>());
+    state.comp_in.assign(components.size(), std::unordered_map<int, int>());
+    for (int u = 0; u < n; u++) {
+        for (int v : g.out[u]) {
+            if (state.comp[u] != state.comp[v]) {
+                state.comp_out[state.comp[u]][state.comp[v]]++;
+                state.comp_in[state.comp[v]][state.comp[u]]++;
+            }
+        }
+    }
+
+    // Every component is new
+    state.summary.assign(n, SubtreeSummary());
+    std::vector<int> all(components.size());
+    for (size_t c = 0; c < components.size(); c++) {
+        all[c] = c;
+    }
+    update_summaries(state, all);
+}
+
+// Number of a node in the state, added as its own component if it is new
+int state_node(AnalysisState& state, const std::string& name) {
+    auto it = state.g.index.find(name);
+    if (it != state.g.index.end()) {
+        return it->second;
+    }
+    int id = state.g.names.size();
+    state.g.names.push_back(name);
+    state.g.index[name] = id;
+    state.g.out.push_back(std::vector<int>());
+    state.g.in.push_back(std::vector<int>());
+    state.g.weight.push_back(std::vector<double>());
+    state.graph.nodes.insert(name);
+    state.comp.push_back(state.members.size());
+    state.members.push_back(std::vector<int>(1, id));
+    state.comp_cyclic.push_back(false);
+    state.comp_out.push_back(std::unordered_map<int, int>());
+    state.comp_in.push_back(std::unordered_map<int, int>());
+    state.summary.push_back(leaf_summary(name));
+    return id;
+}
+
+// Replace the given components by new ones made of `parts`, and rebuild the
+// condensation edges around them from the node edges
+void replace_components(AnalysisState& state, const std::vector<int>& old_comps,
+                        const std::vector<std::vector<int> >& parts, std::vector<int>& changed) {
+    for (int old : old_comps) {
+        for (const auto& edge : state.comp_out[old]) {
+            state.comp_in[edge.first].erase(old);
+        }
+        for (const auto& edge : state.comp_in[old]) {
+            state.comp_out[edge.first].erase(old);
+        }
+        state.comp_out[old].clear();
+        state.comp_in[old].clear();
+        state.members[old].clear();
+    }
+    std::vector<int> new_comps;
+    for (const auto& part : parts) {
+        int c = state.members.size();
+        state.members.push_back(part);
+        state.comp_cyclic.push_back(is_cyclic_component(part, state.g.out));
+        state.comp_out.push_back(std::unordered_map<int, int>());
+        state.comp_in.push_back(std::unordered_map<int, int>());
+        for (int node : part) {
+            state.comp[node] = c;
+        }
+        new_comps.push_back(c);
+        changed.push_back(c);
+    }
+    for (int c : new_comps) {
+        for (int u : state.members[c]) {
+            for (int v : state.g.out[u]) {
+                if (state.comp[v] != c) {
+                    state.comp_out[c][state.comp[v]]++;
+                    state.comp_in[state.comp[v]][c]++;
+                }
+            }
+            for (int p : state.g.in[u]) {
+                int from = state.comp[p];
+                if (from != c && std::find(new_comps.begin(), new_comps.end(), from) == new_comps.end()) {
+                    state.comp_out[from][c]++;
+                    state.comp_in[c][from]++;
+                }
+            }
+        }
+    }
+}
+
+// Apply added and removed edges without rebuilding the state. An edge
+// between two components merges the components on a path back from its head
+// to its tail; a removed edge inside a component reruns Tarjan on that
+// component only. Path counts are then recomputed above the changes; the
+// components they were recomputed for are returned.
+std::vector<int> update_state(AnalysisState& state, const std::vector<Edge>& added, const std::vector<Edge>& removed) {
+    std::vector<int> changed, orphaned;
+    std::set<int> split;
+    DepGraph& graph = state.graph;
+
+    for (const Edge& edge : removed) {
+        auto f = state.g.index.find(edge.from), t = state.g.index.find(edge.to);
+        if (f == state.g.index.end() || t == state.g.index.end()) {
+            continue;
+        }
+        int u = f->second, v = t->second;
+        std::vector<int>& out = state.g.out[u];
+        size_t e = 0;
+        while (e < out.size() && !(out[e] == v && state.g.weight[u][e] == edge.weight)) {
+            e++;
+        }
+        if (e == out.size()) {
+            continue;
+        }
+        out.erase(out.begin() + e);
+        state.g.weight[u].erase(state.g.weight[u].begin() + e);
+        state.g.in[v].erase(std::find(state.g.in[v].begin(), state.g.in[v].end(), u));
+        std::vector<std::string>& adj = graph.adj_list[edge.from];
+        for (size_t k = 0; k < adj.size(); k++) {
+            if (adj[k] == edge.to && graph.adj_weight[edge.from][k] == edge.weight) {
+                adj.erase(adj.begin() + k);
+                graph.adj_weight[edge.from].erase(graph.adj_weight[edge.from].begin() + k);
+                break;
+            }
+        }
+        if (adj.empty()) {
+            graph.adj_list.erase(edge.from);
+            graph.adj_weight.erase(edge.from);
+        }
+        std::vector<std::string>& rev = graph.rev_adj_list[edge.to];
+        rev.erase(std::find(rev.begin(), rev.end(), edge.from));
+        if (state.g.in[v].empty()) {
+            orphaned.push_back(v); // a root now, its result is new even if its count is not
+        }
+
+        int c = state.comp[u];
+        changed.push_back(c);
+        if (c != state.comp[v]) {
+            if (--state.comp_out[c][state.comp[v]] == 0) {
+                state.comp_out[c].erase(state.comp[v]);
+                state.comp_in[state.comp[v]].erase(c);
+            } else {
+                state.comp_in[state.comp[v]][c]--;
+            }
+            continue;
+        }
+        split.insert(c);
+    }
+
+    // Components that lost an inner edge may split, each is checked once
+    for (int c : split) {
+        std::vector<int> nodes = state.members[c];
+        std::unordered_set<int> inside(nodes.begin(), nodes.end());
+        std::vector<std::vector<int> > parts = tarjan_scc(nodes, state.g.out, inside);
+        if (parts.size() > 1 || nodes.size() == 1) {
+            replace_components(state, std::vector<int>(1, c), parts, changed);
+        }
+    }
+    for (int v : orphaned) {
+        changed.push_back(state.comp[v]);
+    }
+
+    for (const Edge& edge : added) {
+        int u = state_node(state, edge.from), v = state_node(state, edge.to);
+        state.g.out[u].push_back(v);
+        state.g.weight[u].push_back(edge.weight);
+        state.g.in[v].push_back(u);
+        graph.adj_list[edge.from].push_back(edge.to);
+        graph.adj_weight[edge.from].push_back(edge.weight);
+        graph.rev_adj_list[edge.to].push_back(edge.from);
+
+        int cu = state.comp[u], cv = state.comp[v];
+        changed.push_back(cu);
+        if (cu == cv) {
+            if (u == v && !state.comp_cyclic[cu]) {
+                state.comp_cyclic[cu] = true;
+            }
+            continue;
+        }
+
+        // Components reached from the head that also reach the tail close a cycle
+        std::vector<int> forward, stack(1, cv);
+        std::unordered_set<int> seen_f;
+        seen_f.insert(cv);
+        while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            forward.push_back(c);
+            for (const auto& e : state.comp_out[c]) {
+                if (seen_f.insert(e.first).second) {
+                    stack.push_back(e.first);
+                }
+            }
+        }
+        if (!seen_f.count(cu)) {
+            state.comp_out[cu][cv]++;
+            state.comp_in[cv][cu]++;
+            continue;
+        }
+        std::unordered_set<int> seen_b;
+        stack.assign(1, cu);
+        seen_b.insert(cu);
+        while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            for (const auto& e : state.comp_in[c]) {
+                if (seen_b.insert(e.first).second) {
+                    stack.push_back(e.first);
+                }
+            }
+        }
+        std::vector<int> merged, part;
+        for (int c : forward) {
+            if (seen_b.count(c)) {
+                merged.push_back(c);
+                part.insert(part.end(), state.members[c].begin(), state.members[c].end());
+            }
+        }
+        replace_components(state, merged, std::vector<std::vector<int> >(1, part), changed);
+    }
+
+    // Drop the ids of components that no longer exist
+    changed.erase(std::remove_if(changed.begin(), changed.end(),
+                                 [&](int c) { return state.members[c].empty(); }),
+                  changed.end());
+    state.version++;
+    return update_summaries(state, changed);
+}
+
+// Compare two sorted edge lists in one pass
+void diff_edges(const std::vector<Edge>& before, const std::vector<Edge>& after,
+                std::vector<Edge>& added, std::vector<Edge>& removed) {
+    size_t i = 0, j = 0;
+    while (i < before.size() || j < after.size()) {
+        if (j == after.size() || (i < before.size() && before[i] < after[j])) {
+            removed.push_back(before[i++]);
+        } else if (i == before.size() || after[j] < before[i]) {
+            added.push_back(after[j++]);
+        } else {
+            i++;
+            j++;
+        }
+    }
+}
+
+// Snapshots of the daemon state. A file is a header with a table of
+// sections, then the sections, each a plain array aligned to 8 bytes, so the
+// file can be mapped and checked in place. What is slow to compute is stored
+// (components, subtree summaries, the sorted edges); the condensation and the name
+// index are rebuilt from it in linear time. The arrays are then copied into
+// the containers of AnalysisState rather than served from the mapping, since
+// watched updates change the state in place.
+const char SNAPSHOT_MAGIC[8] = {'G', 'S', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t SNAPSHOT_FORMAT = 3;          // bump when the layout changes
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+enum SnapshotSection {
+    SECTION_NAME_OFFSETS, SECTION_NAME_BYTES, SECTION_OUT_OFFSETS, SECTION_OUT_TARGETS, SECTION_OUT_WEIGHTS,
+    SECTION_COMPONENTS, SECTION_CYCLIC, SECTION_SUMMARIES, SECTION_EDGES, SECTION_COUNT
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t byte_order;
+    uint64_t graph_version;
+    int64_t source_mtime, source_size;       // of the input the state was built from
+    uint64_t filter_hash;                    // of the node filter it was read with
+    uint64_t nodes, components, edges;
+    struct {
+        uint64_t offset, size, checksum;
+    } sections[SECTION_COUNT];
+};
+
+struct SnapshotEdge {
+    uint32_t from, to;
+    double weight;
+};
+
+// Modification time in nanoseconds and size of the input a snapshot is built
+// from, both -1 if it does not exist. A rewrite within the clock resolution
+// of the file system still shows up in the size.
+struct SourceStamp {
+    int64_t mtime = -1;
+    int64_t size = -1;
+};
+
+SourceStamp source_stamp(const std::string& filename) {
+    SourceStamp stamp;
+    struct stat info;
+    if (::stat(filename.c_str(), &info) == 0) {
+        stamp.mtime = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+        stamp.size = info.st_size;
+    }
+    return stamp;
+}
+
+template <typename T>
+void add_section(SnapshotHeader& header, std::string& body, SnapshotSection id, const std::vector<T>& data) {
+    const char* bytes = reinterpret_cast<const char*>(data.data());
+    size_t size = data.size() * sizeof(T);
+    header.sections[id].offset = sizeof(SnapshotHeader) + body.size();
+    header.sections[id].size = size;
+    header.sections[id].checksum = checksum(bytes, size);
+    body.append(bytes, size);
+    body.append((8 - body.size() % 8) % 8, '\0');
+}
+
+// Write the state next to the file and rename it over, so a reader never
+// maps a half-written snapshot
+bool save_snapshot(const AnalysisState& state, const std::string& filename, SourceStamp source, uint64_t filter_hash) {
+    const NumberedGraph& g = state.g;
+    size_t n = g.names.size();
+    std::vector<uint64_t> name_offsets(1, 0), out_offsets(1, 0);
+    std::vector<char> name_bytes;
+    std::vector<uint32_t> targets, components(state.comp.begin(), state.comp.end());
+    std::vector<double> weights;
+    for (size_t u = 0; u < n; u++) {
+        name_bytes.insert(name_bytes.end(), g.names[u].begin(), g.names[u].end());
+        name_offsets.push_back(name_bytes.size());
+        targets.insert(targets.end(), g.out[u].begin(), g.out[u].end());
+        weights.insert(weights.end(), g.weight[u].begin(), g.weight[u].end());
+        out_offsets.push_back(targets.size());
+    }
+    std::vector<uint8_t> cyclic(state.comp_cyclic.begin(), state.comp_cyclic.end());
+    std::vector<SnapshotEdge> edges;
+    for (const Edge& edge : state.edges) {
+        edges.push_back(SnapshotEdge{(uint32_t)g.index.at(edge.from), (uint32_t)g.index.at(edge.to), edge.weight});
+    }
+
+    SnapshotHeader header = {};
+    std::copy(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8, header.magic);
+    header.format = SNAPSHOT_FORMAT;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.graph_version = state.version;
+    header.source_mtime = source.mtime;
+    header.source_size = source.size;
+    header.filter_hash = filter_hash;
+    header.nodes = n;
+    header.components = state.members.size();
+    header.edges = targets.size();
+    std::string body;
+    add_section(header, body, SECTION_NAME_OFFSETS, name_offsets);
+    add_section(header, body, SECTION_NAME_BYTES, name_bytes);
+    add_section(header, body, SECTION_OUT_OFFSETS, out_offsets);
+    add_section(header, body, SECTION_OUT_TARGETS, targets);
+    add_section(header, body, SECTION_OUT_WEIGHTS, weights);
+    add_section(header, body, SECTION_COMPONENTS, components);
+    add_section(header, body, SECTION_CYCLIC, cyclic);
+    add_section(header, body, SECTION_SUMMARIES, state.summary);
+    add_section(header, body, SECTION_EDGES, edges);
+
+    std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(body.data(), body.size());
+    file.close();
+    if (!file || ::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Cannot write snapshot " << filename << std::endl;
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Map a snapshot and rebuild the state from it. It is refused if the format
+// differs, a checksum does not match, or it was taken with another node filter
+// or from another version of the input file, by modification time and size
+// (unless the input is not given or no longer exists).
+bool load_snapshot(const std::string& filename, SourceStamp source, uint64_t filter_hash, AnalysisState& state) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        std::cerr << "Snapshot " << filename << " is too short, rebuilding" << std::endl;
+        return false;
+    }
+    size_t size = info.st_size;
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    const char* data = static_cast<const char*>(mapping);
+    const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(data);
+
+    std::string problem;
+    if (!std::equal(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8, header.magic) || header.byte_order != SNAPSHOT_BYTE_ORDER) {
+        problem = "is not a snapshot";
+    } else if (header.format != SNAPSHOT_FORMAT) {
+        problem = "has format " + std::to_string(header.format);
+    } else if (source.mtime >= 0 && (header.source_mtime != source.mtime || header.source_size != source.size)) {
+        problem = "does not match its input";
+    } else if (header.filter_hash != filter_hash) {
+        problem = "was taken with other filters";
+    }
+    const size_t element[SECTION_COUNT] = {sizeof(uint64_t), 1, sizeof(uint64_t), sizeof(uint32_t), sizeof(double),
+                                           sizeof(uint32_t), 1, sizeof(SubtreeSummary), sizeof(SnapshotEdge)};
+    const uint64_t count[SECTION_COUNT] = {header.nodes + 1, 0, header.nodes + 1, header.edges, header.edges,
+                                           header.nodes, header.components, header.nodes, 0};
+    for (int s = 0; s < SECTION_COUNT && problem.empty(); s++) {
+        uint64_t offset = header.sections[s].offset, length = header.sections[s].size;
+        if (offset % 8 != 0 || offset > size || length > size - offset || length % element[s] != 0 ||
+            (count[s] != 0 && length != count[s] * element[s])) {
+            problem = "is truncated";
+        } else if (checksum(data + offset, length) != header.sections[s].checksum) {
+            problem = "fails its checksum";
+        }
+    }
+    if (!problem.empty()) {
+        ::munmap(mapping, size);
+        std::cerr << "Snapshot " << filename << " " << problem << ", rebuilding" << std::endl;
+        return false;
+    }
+    auto section = [&](int s) { return data + header.sections[s].offset; };
+    const uint64_t* name_offsets = reinterpret_cast<const uint64_t*>(section(SECTION_NAME_OFFSETS));
+    const char* name_bytes = section(SECTION_NAME_BYTES);
+    const uint64_t* out_offsets = reinterpret_cast<const uint64_t*>(section(SECTION_OUT_OFFSETS));
+    const uint32_t* targets = reinterpret_cast<const uint32_t*>(section(SECTION_OUT_TARGETS));
+    const double* weights = reinterpret_cast<const double*>(section(SECTION_OUT_WEIGHTS));
+    const uint32_t* components = reinterpret_cast<const uint32_t*>(section(SECTION_COMPONENTS));
+    const uint8_t* cyclic = reinterpret_cast<const uint8_t*>(section(SECTION_CYCLIC));
+    const SubtreeSummary* summary = reinterpret_cast<const SubtreeSummary*>(section(SECTION_SUMMARIES));
+    const SnapshotEdge* edges = reinterpret_cast<const SnapshotEdge*>(section(SECTION_EDGES));
+    size_t n = header.nodes, edge_count = header.sections[SECTION_EDGES].size / sizeof(SnapshotEdge);
+
+    // The checksums catch damage, these catch a file that is consistent but wrong
+    bool valid = name_offsets[0] == 0 && out_offsets[0] == 0 &&
+                 name_offsets[n] == header.sections[SECTION_NAME_BYTES].size && out_offsets[n] == header.edges;
+    for (size_t u = 0; u < n && valid; u++) {
+        valid = name_offsets[u] <= name_offsets[u + 1] && out_offsets[u] <= out_offsets[u + 1] &&
+                components[u] < header.components;
+    }
+    for (size_t e = 0; e < header.edges && valid; e++) {
+        valid = targets[e] < n;
+    }
+    for (size_t e = 0; e < edge_count && valid; e++) {
+        valid = edges[e].from < n && edges[e].to < n;
+    }
+    if (!valid) {
+        ::munmap(mapping, size);
+        std::cerr << "Snapshot " << filename << " has bad node numbers, rebuilding" << std::endl;
+        return false;
+    }
+
+    NumberedGraph& g = state.g;
+    g = NumberedGraph();
+    g.names.resize(n);
+    g.out.resize(n);
+    g.in.resize(n);
+    g.weight.resize(n);
+    state.graph = DepGraph();
+    for (size_t u = 0; u < n; u++) {
+        g.names[u].assign(name_bytes + name_offsets[u], name_bytes + name_offsets[u + 1]);
+        g.index[g.names[u]] = u;
+    }
+    for (size_t u = 0; u < n; u++) {
+        g.out[u].assign(targets + out_offsets[u], targets + out_offsets[u + 1]);
+        g.weight[u].assign(weights + out_offsets[u], weights + out_offsets[u + 1]);
+        for (size_t k = 0; k < g.out[u].size(); k++) {
+            g.in[g.out[u][k]].push_back(u);
+            state.graph.left_column.push_back(g.names[u]);
+            state.graph.right_column.push_back(g.names[g.out[u][k]]);
+            state.graph.weight_column.push_back(g.weight[u][k]);
+        }
+        if (g.out[u].empty()) {
+            state.graph.nodes.insert(g.names[u]);
+        }
+    }
+    build_adj_list(state.graph);
+
+    state.comp.assign(components, components + n);
+    state.comp_cyclic.assign(cyclic, cyclic + header.components);
+    state.members.assign(header.components, std::vector<int>());
+    for (size_t u = 0; u < n; u++) {
+        state.members[state.comp[u]].push_back(u);
+    }
+    state.comp_out.assign(header.components, std::unordered_map<int, int>());
+    state.comp_in.assign(header.components, std::unordered_map<int, int>());
+    for (size_t u = 0; u < n; u++) {
+        for (int v : g.out[u]) {
+            if (state.comp[u] != state.comp[v]) {
+                state.comp_out[state.comp[u]][state.comp[v]]++;
+                state.comp_in[state.comp[v]][state.comp[u]]++;
+            }
+        }
+    }
+    state.summary.assign(summary, summary + n);
+    state.edges.clear();
+    for (size_t e = 0; e < edge_count; e++) {
+        state.edges.push_back(Edge{g.names[edges[e].from], g.names[edges[e].to], edges[e].weight});
+    }
+    state.version = header.graph_version;
+    ::munmap(mapping, size);
+    return true;
+}
+
+// Query codes of the daemon protocol
+enum QueryCode : unsigned char {
+    QUERY_DEPENDS_ON = 1, // X Y: "1" if X depends on Y, else "0"
+    QUERY_DEPS = 2,       // X: every node X depends on
+    QUERY_RDEPS = 3,      // X: every node depending on X
+    QUERY_CYCLES = 4,     // the circular components
+    QUERY_PATH_COUNT = 5, // X: number of paths from X
+    QUERY_PATHS = 6,      // X [max]: the paths from X
+    QUERY_STATS = 7,      // graph version and cache counters
+};
+
+// Answer of a query: a status and a list of strings
+struct QueryResult {
+    bool ok = true;
+    std::vector<std::string> items;
+};
+
+// Names of the queries on the command line and in batch files
+const std::map<std::string, QueryCode> QUERY_NAMES = {
+    {"depends-on", QUERY_DEPENDS_ON}, {"deps", QUERY_DEPS}, {"rdeps", QUERY_RDEPS},
+    {"cycles", QUERY_CYCLES}, {"path-count", QUERY_PATH_COUNT}, {"paths-from", QUERY_PATHS},
+    {"stats", QUERY_STATS}};
+
+// Nodes reached from `from` (excluded unless on a cycle), walking the
+// condensation so that each component is visited once
+std::vector<int> reached_nodes(const AnalysisState& state, int from, bool reverse) {
+    const std::vector<std::unordered_map<int, int> >& edges = reverse ? state.comp_in : state.comp_out;
+    std::vector<int> nodes;
+    std::unordered_set<int> seen;
+    std::vector<int> stack(1, state.comp[from]);
+    seen.insert(state.comp[from]);
+    while (!stack.empty()) {
+        int c = stack.back();
+        stack.pop_back();
+        for (int node : state.members[c]) {
+            if (node != from || state.comp_cyclic[c]) {
+                nodes.push_back(node);
+            }
+        }
+        for (const auto& edge : edges[c]) {
+            if (seen.insert(edge.first).second) {
+                stack.push_back(edge.first);
+            }
+        }
+    }
+    return nodes;
+}
+
+QueryResult answer_query(const AnalysisState& state, unsigned char code,
+                         const std::vector<std::string>& args, const PathLimits& limits) {
+    QueryResult result;
+    if (code < QUERY_DEPENDS_ON || code > QUERY_PATHS) {
+        result.ok = false;
+        result.items.push_back("unknown query");
+        return result;
+    }
+    std::vector<int> ids;
+    for (const std::string& arg : args) {
+        auto it = state.g.index.find(arg);
+        ids.push_back(it == state.g.index.end() ? -1 : it->second);
+    }
+    size_t needed = code == QUERY_DEPENDS_ON ? 2 : code == QUERY_CYCLES ? 0 : 1;
+    if (args.size() < needed || std::count(ids.begin(), ids.begin() + needed, -1) > 0) {
+        result.ok = false;
+        result.items.push_back("bad arguments");
+        return result;
+    }
+
+    switch (code) {
+    case QUERY_DEPENDS_ON: {
+        // Search the condensation from X until Y's component shows up
+        int target = state.comp[ids[1]];
+        bool depends = ids[0] == ids[1] ? state.comp_cyclic[target] : false;
+        std::unordered_set<int> seen;
+        std::vector<int> stack(1, state.comp[ids[0]]);
+        while (!stack.empty() && !depends && ids[0] != ids[1]) {
+            int c = stack.back();
+            stack.pop_back();
+            depends = c == target;
+            for (const auto& edge : state.comp_out[c]) {
+                if (seen.insert(edge.first).second) {
+                    stack.push_back(edge.first);
+                }
+            }
+        }
+        result.items.push_back(depends ? "1" : "0");
+        break;
+    }
+    case QUERY_DEPS:
+    case QUERY_RDEPS:
+        for (int node : reached_nodes(state, ids[0], code == QUERY_RDEPS)) {
+            result.items.push_back(state.g.names[node]);
+        }
+        break;
+    case QUERY_CYCLES:
+        for (size_t c = 0; c < state.members.size(); c++) {
+            if (!state.comp_cyclic[c] || state.members[c].empty()) {
+                continue;
+            }
+            result.items.push_back(join_sorted_names(state.members[c], state.g.names));
+        }
+        break;
+    case QUERY_PATH_COUNT:
+    case QUERY_PATHS: {
+        double count = state.summary[ids[0]].paths;
+        if (code == QUERY_PATH_COUNT && count >= 0.0) {
+            std::ostringstream text;
+            text.precision(17);
+            text << count;
+            result.items.push_back(text.str());
+            break;
+        }
+        // The limits hold for this query alone. A count asked for in the query
+        // only stops it quietly when it is below the limit.
+        PathLimits query_limits = limits;
+        query_limits.start_time = std::chrono::steady_clock::now();
+        size_t asked = 0;
+        if (code == QUERY_PATHS && args.size() > 1 && !parse_size(args[1], asked)) {
+            result.ok = false;
+            result.items.push_back("bad count: " + args[1]);
+            break;
+        }
+        bool quiet = asked > 0 && (limits.max_total_paths == 0 || asked <= limits.max_total_paths);
+        if (quiet) {
+            query_limits.max_total_paths = asked;
+        }
+        std::set<std::string> paths = paths_from(state.graph, std::vector<std::string>(1, args[0]), query_limits);
+        bool over_time = query_limits.reasons.count("time budget") > 0;
+        bool over_count = query_limits.reasons.count("max total paths") > 0 && !quiet;
+        if (over_time || over_count) {
+            result.ok = false;
+            result.items.push_back(over_time ? "query limit reached: time budget" : "query limit reached: max total paths");
+            break;
+        }
+        if (code == QUERY_PATH_COUNT) {
+            result.items.push_back(std::to_string(paths.size()) + (query_limits.reasons.empty() ? "" : "+"));
+        } else {
+            result.items.assign(paths.begin(), paths.end());
+        }
+        break;
+    }
+    }
+    return result;
+}
+
+// Largest frames read: requests only hold a few names, responses may list
+// many paths
+const size_t MAX_REQUEST_BYTES = 1 << 20;
+const size_t MAX_RESPONSE_BYTES = 1 << 30;
+
+// Frames are a 32-bit length followed by the payload. A request payload is
+// the query code and its arguments, a response payload is a status byte
+// (0 for ok) and a 32-bit item count; strings are a 32-bit length and bytes.
+// Integers are little endian.
+void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char)(value >> (8 * i)));
+    }
+}
+
+bool get_u32(const std::string& in, size_t& pos, uint32_t& value) {
+    if (pos + 4 > in.size()) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)(unsigned char)in[pos + i] << (8 * i);
+    }
+    pos += 4;
+    return true;
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put_u32(out, s.size());
+    out += s;
+}
+
+bool get_string(const std::string& in, size_t& pos, std::string& s) {
+    uint32_t size;
+    if (!get_u32(in, pos, size) || pos + size > in.size()) {
+        return false;
+    }
+    s = in.substr(pos, size);
+    pos += size;
+    return true;
+}
+
+// Sockets only: MSG_NOSIGNAL turns a client that went away into EPIPE, which
+// ends its session like any other failed write, instead of a SIGPIPE
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool write_frame(int fd, const std::string& payload) {
+    std::string frame;
+    put_u32(frame, payload.size());
+    frame += payload;
+    return write_all(fd, frame.data(), frame.size());
+}
+
+// A frame longer than max_size is refused before anything is allocated
+bool read_frame(int fd, std::string& payload, size_t max_size) {
+    std::string header(4, '\0');
+    size_t pos = 0;
+    uint32_t size;
+    if (!read_all(fd, &header[0], 4) || !get_u32(header, pos, size) || size > max_size) {
+        return false;
+    }
+    payload.assign(size, '\0');
+    return size == 0 || read_all(fd, &payload[0], size);
+}
+
+// Encoded responses of recent queries, least recently used first out. Every
+// entry is keyed by the graph version it was computed on, so during an update
+// the readers of the old and of the new copy each find their own answers. The
+// writer drops the older versions once no reader can see them. The entries
+// are split in shards with a lock each, so readers only meet on a shard.
+struct QueryCache {
+    static const size_t shards = 64;
+    struct Entry {
+        std::string key, response;
+        uint64_t version;
+    };
+    struct Shard {
+        std::mutex lock;
+        std::list<Entry> entries; // most recent first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+
+        void drop(std::list<Entry>::iterator it) {
+            bytes -= it->key.size() + it->response.size();
+            index.erase(it->key);
+            entries.erase(it);
+        }
+    };
+    size_t max_bytes = 64 << 20;   // over all shards
+    Shard parts[shards];
+    std::atomic<uint64_t> hits{0}, misses{0};
+
+    std::string key(uint64_t graph_version, const std::string& request) const {
+        return std::to_string(graph_version) + ':' + request;
+    }
+    Shard& shard(const std::string& k) {
+        return parts[std::hash<std::string>()(k) % shards];
+    }
+
+    bool get(uint64_t graph_version, const std::string& request, std::string& response) {
+        std::string k = key(graph_version, request);
+        Shard& part = shard(k);
+        std::lock_guard<std::mutex> guard(part.lock);
+        auto it = part.index.find(k);
+        if (it == part.index.end()) {
+            misses++;
+            return false;
+        }
+        hits++;
+        part.entries.splice(part.entries.begin(), part.entries, it->second);
+        response = it->second->response;
+        return true;
+    }
+
+    void put(uint64_t graph_version, const std::string& request, const std::string& response) {
+        std::string k = key(graph_version, request);
+        size_t size = k.size() + response.size();
+        size_t limit = max_bytes / shards;
+        Shard& part = shard(k);
+        std::lock_guard<std::mutex> guard(part.lock);
+        if (size > limit || part.index.count(k)) {
+            return;
+        }
+        part.entries.push_front(Entry{k, response, graph_version});
+        part.index[k] = part.entries.begin();
+        part.bytes += size;
+        while (part.bytes > limit) {
+            part.drop(std::prev(part.entries.end()));
+        }
+    }
+
+    // Forget the answers computed on versions before `oldest`
+    void drop_before(uint64_t oldest) {
+        for (Shard& part : parts) {
+            std::lock_guard<std::mutex> guard(part.lock);
+            for (auto it = part.entries.begin(); it != part.entries.end();) {
+                auto next = std::next(it);
+                if (it->version < oldest) {
+                    part.drop(it);
+                }
+                it = next;
+            }
+        }
+    }
+
+    // Entry count and bytes over all shards
+    std::pair<size_t, size_t> size() {
+        std::pair<size_t, size_t> total(0, 0);
+        for (Shard& part : parts) {
+            std::lock_guard<std::mutex> guard(part.lock);
+            total.first += part.entries.size();
+            total.second += part.bytes;
+        }
+        return total;
+    }
+};
+
+// Two copies of the daemon state, so that queries never wait for an update
+// (a left-right scheme). Readers pin the published copy by recording the
+// current epoch in a slot of their own. The writer changes the other copy,
+// publishes it and starts a new epoch, waits until no reader is pinned to an
+// older epoch, then replays the same change on the copy it left.
+struct StateVersions {
+    static const size_t SLOTS = 256;        // clients served at once; more wait for a slot
+    AnalysisState copies[2];
+    std::atomic<int> published{0};
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<uint64_t> pinned[SLOTS];    // epoch of each reader, 0 when idle
+    std::atomic<bool> taken[SLOTS];
+
+    StateVersions() {
+        for (size_t i = 0; i < SLOTS; i++) {
+            pinned[i].store(0);
+            taken[i].store(false);
+        }
+    }
+
+    size_t claim_slot() {
+        for (size_t i = 0;; i = (i + 1) % SLOTS) {
+            bool free = false;
+            if (taken[i].compare_exchange_strong(free, true)) {
+                return i;
+            }
+            if (i == SLOTS - 1) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void release_slot(size_t slot) {
+        taken[slot].store(false);
+    }
+
+    const AnalysisState& pin(size_t slot) {
+        pinned[slot].store(epoch.load());
+        return copies[published.load()];
+    }
+    void unpin(size_t slot) {
+        pinned[slot].store(0);
+    }
+
+    // The copy the writer may read without pinning: the writer is the only
+    // one who changes either copy
+    const AnalysisState& current() const {
+        return copies[published.load()];
+    }
+
+    // Apply `change` to both copies, one at a time; it must give the same
+    // result on both
+    template <typename Change>
+    void update(Change change) {
+        int next = 1 - published.load();
+        change(copies[next]);
+        published.store(next);
+        uint64_t now = epoch.fetch_add(1) + 1;
+        // Readers finish within the query time budget; back off from yielding
+        // to sleeping so a slow one does not keep the writer spinning
+        auto start = std::chrono::steady_clock::now();
+        bool warned = false;
+        for (size_t i = 0; i < SLOTS; i++) {
+            for (uint64_t e = pinned[i].load(), wait = 0; e != 0 && e < now; e = pinned[i].load(), wait++) {
+                if (wait < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(std::min<uint64_t>(wait, 10000)));
+                }
+                if (!warned && std::chrono::steady_clock::now() - start > std::chrono::seconds(10)) {
+                    std::cerr << "Update waits for a query still running on the old version" << std::endl;
+                    warned = true;
+                }
+            }
+        }
+        change(copies[1 - next]);
+    }
+};
+
+// What the daemon threads share
+struct DaemonContext {
+    StateVersions* versions;
+    PathLimits limits;
+    std::string snapshot_file;     // rewritten after each update when set
+    uint64_t filter_hash = 0;
+    QueryCache cache;
+};
+
+// Serve the queries of one client until it disconnects
+void serve_client(int fd, DaemonContext& daemon) {
+    std::string request;
+    size_t slot = daemon.versions->claim_slot();
+    while (read_frame(fd, request, MAX_REQUEST_BYTES)) {
+        const AnalysisState& state = daemon.versions->pin(slot);
+        std::string response;
+        if (!request.empty() && request[0] == QUERY_STATS) {
+            QueryCache& cache = daemon.cache;
+            std::pair<size_t, size_t> size = cache.size();
+            std::vector<std::string> items;
+            items.push_back("version " + std::to_string(state.version));
+            items.push_back("cache hits " + std::to_string(cache.hits.load()));
+            items.push_back("cache misses " + std::to_string(cache.misses.load()));
+            items.push_back("cache entries " + std::to_string(size.first));
+            items.push_back("cache bytes " + std::to_string(size.second));
+            response.assign(1, 0);
+            put_u32(response, items.size());
+            for (const std::string& item : items) {
+                put_string(response, item);
+            }
+        } else if (!daemon.cache.get(state.version, request, response)) {
+            size_t pos = 1;
+            std::vector<std::string> args;
+            std::string arg;
+            uint32_t count = 0;
+            QueryResult result;
+            if (request.empty() || !get_u32(request, pos, count)) {
+                result.ok = false;
+                result.items.push_back("bad request");
+            } else {
+                for (uint32_t i = 0; i < count && get_string(request, pos, arg); i++) {
+                    args.push_back(arg);
+                }
+                result = answer_query(state, request[0], args, daemon.limits);
+            }
+            response.assign(1, result.ok ? 0 : 1);
+            put_u32(response, result.items.size());
+            for (const std::string& item : result.items) {
+                put_string(response, item);
+            }
+            if (result.ok) {
+                daemon.cache.put(state.version, request, response);
+            }
+        }
+        daemon.versions->unpin(slot);
+        if (!write_frame(fd, response)) {
+            break;
+        }
+    }
+    daemon.versions->release_slot(slot);
+    ::close(fd);
+}
+
+// Reread the input whenever it is written or replaced, and apply the edges
+// that changed to the daemon state. The directory is watched, not the file,
+// so editors that save by renaming a new file over the old one are seen too.
+void watch_input(DaemonContext& daemon, const std::string& filename, NodeFilter filter) {
+    size_t slash = filename.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : filename.substr(0, std::max<size_t>(slash, 1));
+    std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+    int fd = ::inotify_init();
+    if (fd < 0 || ::inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Cannot watch " << filename << std::endl;
+        return;
+    }
+
+    std::vector<char> buffer(64 * 1024);
+    while (true) {
+        ssize_t length = ::read(fd, buffer.data(), buffer.size());
+        if (length <= 0) {
+            continue;
+        }
+        bool touched = false;
+        for (ssize_t pos = 0; pos < length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + pos);
+            if (event->len > 0 && name == event->name) {
+                touched = true;
+            }
+            pos += sizeof(inotify_event) + event->len;
+        }
+        if (!touched) {
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        DepGraph fresh;
+        if (!read_dependencies(filename, fresh, filter)) {
+            // Missing or cut short halfway through a rewrite: keep the current
+            // graph rather than removing every edge, the next save is seen again
+            std::cerr << "Cannot read " << filename << ", update skipped" << std::endl;
+            continue;
+        }
+        std::vector<Edge> edges;
+        for (size_t j = 0; j < fresh.left_column.size(); j++) {
+            edges.push_back(Edge{fresh.left_column[j], fresh.right_column[j], fresh.weight_column[j]});
+        }
+        std::sort(edges.begin(), edges.end());
+        std::vector<Edge> added, removed;
+        StateVersions& versions = *daemon.versions;
+        diff_edges(versions.current().edges, edges, added, removed);
+        if (added.empty() && removed.empty()) {
+            continue;
+        }
+        versions.update([&](AnalysisState& state) {
+            update_state(state, added, removed);
+            state.edges = edges;
+        });
+        uint64_t version = versions.current().version;
+        // Both copies hold the new version now, and no reader is left on the old one
+        daemon.cache.drop_before(version);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Reloaded " << filename << ": " << added.size() << " edges added, " << removed.size()
+                  << " removed, version " << version << " (" << elapsed.count() << " s)" << std::endl;
+        if (!daemon.snapshot_file.empty()) {
+            save_snapshot(versions.current(), daemon.snapshot_file, source_stamp(filename), daemon.filter_hash);
+        }
+    }
+}
+
+// Load the graph once and answer queries on a Unix socket, one thread per client.
+// With a watched file, edits to it are applied while serving.
+int run_daemon(AnalysisState& state, const std::string& socket_path, const PathLimits& limits, size_t cache_bytes,
+               const std::string& watch_file, const NodeFilter& filter, const std::string& snapshot_file,
+               uint64_t filter_hash) {
+    // The second copy doubles the memory, so it is only made when the graph
+    // can change
+    StateVersions versions;
+    versions.copies[0] = std::move(state);
+    if (!watch_file.empty()) {
+        versions.copies[1] = versions.copies[0];
+    }
+    // A client that closes its socket before reading the reply must not
+    // take the daemon down
+    std::signal(SIGPIPE, SIG_IGN);
+    DaemonContext daemon;
+    daemon.versions = &versions;
+    daemon.limits = limits;
+    daemon.cache.max_bytes = cache_bytes;
+    daemon.snapshot_file = snapshot_file;
+    daemon.filter_hash = filter_hash;
+
+    int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (server < 0 || socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Cannot create socket " << socket_path << std::endl;
+        return 1;
+    }
+    std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+    ::unlink(socket_path.c_str());
+    if (::bind(server, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(server, 64) < 0) {
+        std::cerr << "Cannot listen on " << socket_path << std::endl;
+        return 1;
+    }
+    std::cout << "Serving " << versions.current().g.names.size() << " nodes on " << socket_path << std::endl;
+    if (!watch_file.empty()) {
+        std::thread(watch_input, std::ref(daemon), watch_file, filter).detach();
+    }
+
+    while (true) {
+        int client = ::accept(server, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+        std::thread(serve_client, client, std::ref(daemon)).detach();
+    }
+}
+
+// Send one query to a running daemon and print the answer
+int run_query(const std::string& socket_path, const std::vector<std::string>& args) {
+    if (args.size() < 2 || !QUERY_NAMES.count(args[1])) {
+        std::cerr << "Usage: query depends-on|deps|rdeps|cycles|path-count|paths-from|stats [args] [--socket=path]" << std::endl;
+        return 1;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::copy(socket_path.begin(), socket_path.begin() + std::min(socket_path.size(), sizeof(address.sun_path) - 1),
+              address.sun_path);
+    if (fd < 0 || ::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Cannot connect to " << socket_path << std::endl;
+        return 1;
+    }
+
+    std::string request(1, QUERY_NAMES.at(args[1]));
+    put_u32(request, args.size() - 2);
+    for (size_t i = 2; i < args.size(); i++) {
+        put_string(request, args[i]);
+    }
+    std::string response;
+    size_t pos = 1;
+    uint32_t count = 0;
+    if (!write_frame(fd, request) || !read_frame(fd, response, MAX_RESPONSE_BYTES) || response.empty() || !get_u32(response, pos, count)) {
+        std::cerr << "No answer from " << socket_path << std::endl;
+        ::close(fd);
+        return 1;
+    }
+    ::close(fd);
+    std::string item;
+    for (uint32_t i = 0; i < count && get_string(response, pos, item); i++) {
+        (response[0] == 0 ? std::cout : std::cerr) << item << std::endl;
+    }
+    return response[0] == 0 ? 0 : 1;
+}
+
+// Answer a file of queries, one per line as for `query`, in one process.
+// Repeated questions are answered once, and all depends-on questions share
+// one pass over the condensation per block of targets: components are taken
+// successors first and each one ORs the target bits of its successors.
+int run_batch(DepGraph& graph, const std::vector<std::string>& args, const PathLimits& limits) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: batch queries.txt" << std::endl;
+        return 1;
+    }
+    std::ifstream file(args[1]);
+    if (!file) {
+        std::cerr << "Cannot read " << args[1] << std::endl;
+        return 1;
+    }
+    AnalysisState state;
+    state.graph = std::move(graph);
+    build_state(state);
+
+    struct BatchQuery {
+        std::string text;
+        unsigned char code;
+        std::vector<std::string> args;
+        QueryResult result;
+    };
+    std::vector<BatchQuery> queries;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line);
+        std::string name, arg;
+        if (!(words >> name) || name[0] == '#') {
+            continue;
+        }
+        BatchQuery query;
+        query.text = line;
+        auto it = QUERY_NAMES.find(name);
+        query.code = it == QUERY_NAMES.end() ? 0 : it->second;
+        while (words >> arg) {
+            query.args.push_back(arg);
+        }
+        queries.push_back(query);
+    }
+
+    // Depends-on targets, numbered by component
+    std::unordered_map<int, size_t> slot;
+    std::vector<int> targets;
+    std::vector<size_t> depends_on;
+    std::map<std::pair<unsigned char, std::vector<std::string> >, size_t> first;
+    std::vector<size_t> same(queries.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+        BatchQuery& query = queries[i];
+        auto known = first.insert(std::make_pair(std::make_pair(query.code, query.args), i));
+        same[i] = known.first->second;
+        if (!known.second) {
+            continue;
+        }
+        auto x = state.g.index.find(query.args.empty() ? "" : query.args[0]);
+        auto y = state.g.index.find(query.args.size() < 2 ? "" : query.args[1]);
+        if (query.code != QUERY_DEPENDS_ON || x == state.g.index.end() || y == state.g.index.end() ||
+            x->second == y->second) {
+            query.result = answer_query(state, query.code, query.args, limits);
+            continue;
+        }
+        int target = state.comp[y->second];
+        if (slot.insert(std::make_pair(target, targets.size())).second) {
+            targets.push_back(target);
+        }
+        depends_on.push_back(i);
+    }
+
+    // graph_scc lists components successors first. The bits per component
+    // are capped so the table stays near 256 MiB.
+    size_t components = state.members.size();
+    size_t words = std::max<size_t>(1, std::min<size_t>((targets.size() + 63) / 64, (1 << 25) / std::max<size_t>(components, 1)));
+    std::vector<uint64_t> reach(components * words);
+    for (size_t block = 0; block < targets.size(); block += 64 * words) {
+        std::fill(reach.begin(), reach.end(), 0);
+        for (size_t c = 0; c < components; c++) {
+            uint64_t* row = &reach[c * words];
+            for (const auto& edge : state.comp_out[c]) {
+                const uint64_t* next = &reach[edge.first * words];
+                for (size_t w = 0; w < words; w++) {
+                    row[w] |= next[w];
+                }
+            }
+            auto own = slot.find(c);
+            if (own != slot.end() && own->second >= block && own->second < block + 64 * words) {
+                size_t bit = own->second - block;
+                row[bit / 64] |= 1ULL << (bit % 64);
+            }
+        }
+        for (size_t i : depends_on) {
+            size_t s = slot[state.comp[state.g.index.at(queries[i].args[1])]];
+            if (s >= block && s < block + 64 * words) {
+                size_t bit = s - block;
+                bool depends = reach[state.comp[state.g.index.at(queries[i].args[0])] * words + bit / 64] >> (bit % 64) & 1;
+                queries[i].result.items.assign(1, depends ? "1" : "0");
+            }
+        }
+    }
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        const QueryResult& result = queries[same[i]].result;
+        std::cout << queries[i].text << ":" << (result.ok ? "" : "\terror:");
+        for (size_t k = 0; k < result.items.size(); k++) {
+            std::cout << '\t' << result.items[k];
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+// Print the summary of the given nodes, or of every root and their totals
+int run_summary(const DepGraph& graph, const std::vector<std::string>& args) {
+    NumberedGraph g = number_graph(graph);
+    std::vector<SubtreeSummary> summary = subtree_summaries(g);
+    std::vector<std::string> nodes(args.begin() + 1, args.end());
+    bool totals = nodes.empty();
+    if (totals) {
+        nodes = traversal_roots(graph);
+    }
+
+    double paths = 0.0;
+    uint64_t depth = 0;
+    size_t cyclic = 0;
+    for (const std::string& node : nodes) {
+        auto it = g.index.find(node);
+        if (it == g.index.end()) {
+            std::cerr << "Unknown node: " << node << std::endl;
+            return 1;
+        }
+        const SubtreeSummary& s = summary[it->second];
+        std::cout << node << ": ";
+        if (s.reaches_cycle()) {
+            std::cout << "reaches a cycle";
+            cyclic++;
+        } else {
+            std::cout << s.paths << " paths";
+            paths += s.paths;
+        }
+        std::cout << ", depth " << s.depth << std::endl;
+        depth = std::max(depth, s.depth);
+    }
+    if (totals) {
+        std::cout << "Roots: " << nodes.size() << ", reaching a cycle: " << cyclic << std::endl;
+        std::cout << "Paths from the roots without cycles: " << paths << std::endl;
+        std::cout << "Maximum depth: " << depth << std::endl;
+    }
+    return 0;
+}
+
+// Sorted names of the circular components that hold one of the nodes
+std::set<std::string> touched_cycles(const AnalysisState& state, const std::vector<std::string>& nodes) {
+    std::set<std::string> found;
+    for (const std::string& node : nodes) {
+        auto it = state.g.index.find(node);
+        if (it == state.g.index.end() || !state.comp_cyclic[state.comp[it->second]]) {
+            continue;
+        }
+        found.insert(join_sorted_names(state.members[state.comp[it->second]], state.g.names));
+    }
+    return found;
+}
+
+std::string describe_count(double paths) {
+    std::ostringstream text;
+    if (paths < 0.0) {
+        text << "reaches a cycle";
+    } else {
+        text << paths << " paths";
+    }
+    return text.str();
+}
+
+// Analyse the input against the state saved by the previous run: only the
+// components touched by the changed edges and the nodes above them are
+// recomputed, and only what changed there is reported. The state file is
+// then replaced for the next run.
+int run_reanalyze(DepGraph& graph, const std::string& state_file, SourceStamp input, uint64_t filter_hash) {
+    AnalysisState state;
+    if (!load_snapshot(state_file, SourceStamp(), filter_hash, state)) {
+        state.graph = std::move(graph);
+        build_state(state);
+        std::cout << "No previous state, analysed " << state.g.names.size() << " nodes" << std::endl;
+        return save_snapshot(state, state_file, input, filter_hash) ? 0 : 1;
+    }
+
+    std::vector<Edge> edges;
+    for (size_t j = 0; j < graph.left_column.size(); j++) {
+        edges.push_back(Edge{graph.left_column[j], graph.right_column[j], graph.weight_column[j]});
+    }
+    std::sort(edges.begin(), edges.end());
+    std::vector<Edge> added, removed;
+    diff_edges(state.edges, edges, added, removed);
+
+    // Old results of the nodes the change can touch
+    std::vector<std::string> ends;
+    for (const std::vector<Edge>* list : {&added, &removed}) {
+        for (const Edge& edge : *list) {
+            ends.push_back(edge.from);
+            ends.push_back(edge.to);
+        }
+    }
+    std::set<std::string> cycles_before = touched_cycles(state, ends);
+    std::vector<SubtreeSummary> old_summary = state.summary; // node numbers are kept, new nodes come last
+    std::vector<bool> old_root(state.g.names.size());
+    for (size_t u = 0; u < old_root.size(); u++) {
+        old_root[u] = state.g.in[u].empty() && !state.g.out[u].empty();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> dirty = update_state(state, added, removed);
+    state.edges = std::move(edges);
+    std::set<std::string> cycles_after = touched_cycles(state, ends);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t nodes = 0;
+    std::vector<std::string> roots;
+    for (int c : dirty) {
+        for (int u : state.members[c]) {
+            nodes++;
+            if (state.g.in[u].empty() && !state.g.out[u].empty()) {
+                roots.push_back(state.g.names[u]);
+            }
+        }
+    }
+    std::sort(roots.begin(), roots.end());
+    std::cout << "Changed edges: " << added.size() << " added, " << removed.size() << " removed" << std::endl;
+    std::cout << "Re-analysed " << nodes << " of " << state.g.names.size() << " nodes in " << elapsed.count()
+              << " s" << std::endl;
+    for (const std::string& cycle : cycles_after) {
+        if (!cycles_before.count(cycle)) {
+            std::cout << "New circular component: " << cycle << std::endl;
+        }
+    }
+    for (const std::string& cycle : cycles_before) {
+        if (!cycles_after.count(cycle)) {
+            std::cout << "No longer circular: " << cycle << std::endl;
+        }
+    }
+    for (const std::string& root : roots) {
+        size_t u = state.g.index.at(root);
+        if (u >= old_summary.size() || !old_root[u]) {
+            std::cout << "New root " << root << ": " << describe_count(state.summary[u].paths) << std::endl;
+        } else if (old_summary[u].paths != state.summary[u].paths) {
+            std::cout << "Root " << root << ": " << describe_count(old_summary[u].paths) << " -> "
+                      << describe_count(state.summary[u].paths) << std::endl;
+        }
+    }
+    return save_snapshot(state, state_file, input, filter_hash) ? 0 : 1;
+}
+
+// A small query language over the graph:
+//
+//   query  := expr [ "within" filter ]
+//   expr   := term { ("&" | "|" | "-") term }      left to right
+//   term   := "(" expr ")" | deps(X) | rdeps(X) | cycles() | nodes()
+//           | path(X, Y [, maxlen=N])
+//   filter := ( prefix("s") | regex("r") ) { "|" filter }
+//
+// Names may be quoted, and have to be when they contain punctuation such as
+// `-`. A query is parsed, compiled into a plan and run on
+// the numbered graph. `within` is pushed into every traversal, so nothing
+// outside the scope is visited, and a prefix scope is a range of the sorted
+// node numbers. `deps(X) & rdeps(Y)` runs the second traversal inside the
+// result of the first: every node on a path from X to Y is reached from X.
+struct QueryExpr {
+    std::string op;                 // deps, rdeps, path, cycles, nodes, &, |, -
+    std::vector<std::string> args;
+    size_t maxlen = 0;
+    std::unique_ptr<QueryExpr> left, right;
+    bool restrict_right = false;    // plan: run `right` inside the result of `left`
+};
+
+struct QueryParser {
+    static constexpr const char* punctuation = "()&|-,=";
+
+    std::string text;
+    size_t pos = 0;
+    std::string error;
+
+    void skip() {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+    }
+    // A punctuation character, a quoted string or a bare word
+    std::string peek() {
+        size_t saved = pos;
+        std::string token = next();
+        pos = saved;
+        return token;
+    }
+    std::string next() {
+        skip();
+        if (pos == text.size()) {
+            return "";
+        }
+        if (std::strchr(punctuation, text[pos])) {
+            return std::string(1, text[pos++]);
+        }
+        if (text[pos] == '"') {
+            size_t end = text.find('"', pos + 1);
+            if (end == std::string::npos) {
+                error = "unterminated string";
+                pos = text.size();
+                return "";
+            }
+            std::string token = text.substr(pos, end + 1 - pos);
+            pos = end + 1;
+            return token;
+        }
+        size_t start = pos;
+        while (pos < text.size() && !std::isspace((unsigned char)text[pos]) &&
+               !std::strchr(punctuation, text[pos]) && text[pos] != '"') {
+            pos++;
+        }
+        return text.substr(start, pos - start);
+    }
+    bool expect(const std::string& token) {
+        if (next() != token && error.empty()) {
+            error = "expected '" + token + "' at " + std::to_string(pos);
+        }
+        return error.empty();
+    }
+    std::string name() {
+        std::string token = next();
+        if (token.size() >= 2 && token[0] == '"') {
+            return token.substr(1, token.size() - 2);
+        }
+        if ((token.empty() || std::strchr(punctuation, token[0])) && error.empty()) {
+            error = "expected a name at " + std::to_string(pos);
+        }
+        return token;
+    }
+
+    std::unique_ptr<QueryExpr> expr() {
+        std::unique_ptr<QueryExpr> left = term();
+        while (error.empty() && (peek() == "&" || peek() == "|" || peek() == "-")) {
+            std::unique_ptr<QueryExpr> node(new QueryExpr);
+            node->op = next();
+            node->left = std::move(left);
+            node->right = term();
+            left = std::move(node);
+        }
+        return left;
+    }
+    std::unique_ptr<QueryExpr> term() {
+        std::unique_ptr<QueryExpr> node(new QueryExpr);
+        std::string token = next();
+        if (token == "(") {
+            node = expr();
+            expect(")");
+            return node;
+        }
+        node->op = token;
+        size_t arity = token == "deps" || token == "rdeps" ? 1 : token == "path" ? 2 : 0;
+        if (token != "deps" && token != "rdeps" && token != "path" && token != "cycles" && token != "nodes") {
+            if (error.empty()) {
+                error = "unknown term '" + token + "'";
+            }
+            return node;
+        }
+        expect("(");
+        for (size_t i = 0; i < arity && error.empty(); i++) {
+            if (i > 0) {
+                expect(",");
+            }
+            node->args.push_back(name());
+        }
+        if (token == "path" && peek() == ",") {
+            next();
+            if (next() == "maxlen" && expect("=")) {
+                std::string value = next();
+                if (!parse_size(value, node->maxlen) && error.empty()) {
+                    error = "bad maxlen '" + value + "'";
+                }
+            } else if (error.empty()) {
+                error = "expected maxlen=N";
+            }
+        }
+        expect(")");
+        return node;
+    }
+};
+
+// Nodes a query may visit, all of them unless the query has a `within`
+struct QueryScope {
+    bool everything = true;
+    std::unordered_set<int> nodes;
+
+    bool has(int node) const {
+        return everything || nodes.count(node) > 0;
+    }
+};
+
+// Parse `prefix("a") | regex("b")` and collect the nodes it keeps. The names
+// are sorted, so a prefix is found by binary search and only its range is
+// visited; a regex has to look at every name.
+bool parse_scope(QueryParser& parser, const NumberedGraph& g, QueryScope& scope, std::string& plan) {
+    scope.everything = false;
+    while (true) {
+        std::string kind = parser.next();
+        if (!parser.expect("(")) {
+            return false;
+        }
+        std::string value = parser.name();
+        if (!parser.expect(")")) {
+            return false;
+        }
+        if (kind == "prefix") {
+            size_t first = std::lower_bound(g.names.begin(), g.names.end(), value) - g.names.begin();
+            size_t last = first;
+            while (last < g.names.size() && g.names[last].compare(0, value.size(), value) == 0) {
+                scope.nodes.insert(last++);
+            }
+            plan += "scope: prefix \"" + value + "\", nodes " + std::to_string(first) + ".." + std::to_string(last) + "\n";
+        } else if (kind == "regex") {
+            std::regex pattern;
+            try {
+                pattern.assign(value);
+            } catch (const std::regex_error& e) {
+                parser.error = "bad regex \"" + value + "\": " + e.what();
+                return false;
+            }
+            for (size_t i = 0; i < g.names.size(); i++) {
+                if (std::regex_search(g.names[i], pattern)) {
+                    scope.nodes.insert(i);
+                }
+            }
+            plan += "scope: regex \"" + value + "\", scan of all names\n";
+        } else {
+            parser.error = "unknown filter '" + kind + "'";
+            return false;
+        }
+        if (parser.peek() != "|") {
+            return true;
+        }
+        parser.next();
+    }
+}
+
+// Choose how to run each operator, and describe the plan
+void plan_query(QueryExpr& node, std::string& plan, int indent) {
+    std::string pad(2 * indent, ' ');
+    if (node.op == "&" || node.op == "|" || node.op == "-") {
+        // Nodes on a path from X to Y are all reached from X, so the search
+        // back from Y can stay inside deps(X), and the other way round
+        node.restrict_right = node.op == "&" && node.left->op != node.right->op &&
+            (node.left->op == "deps" || node.left->op == "rdeps") &&
+            (node.right->op == "deps" || node.right->op == "rdeps");
+        plan += pad + node.op + (node.restrict_right ? " (right side searched inside the left result)" : "") + "\n";
+        plan_query(*node.left, plan, indent + 1);
+        plan_query(*node.right, plan, indent + 1);
+        return;
+    }
+    plan += pad + node.op + "(";
+    for (size_t i = 0; i < node.args.size(); i++) {
+        plan += (i > 0 ? ", " : "") + node.args[i];
+    }
+    if (node.op == "path") {
+        plan += node.maxlen > 0 ? ", maxlen=" + std::to_string(node.maxlen) : "";
+        plan += ") searched forward, pruned by hop distances to the target";
+    } else {
+        plan += node.op == "deps" ? ") forward search" :
+                node.op == "rdeps" ? ") backward search" :
+                node.op == "cycles" ? ") Tarjan inside the scope" : ") all nodes of the scope";
+    }
+    plan += "\n";
+}
+
+// Result of a query: nodes, circular components, or paths
+struct QueryValue {
+    std::set<int> nodes;
+    std::vector<std::vector<int> > groups;  // set for cycles()
+    std::vector<std::string> paths;         // set for path()
+    bool is_paths = false;
+};
+
+// Nodes reached from `start` through the scope, the start included only if
+// it is reached again
+std::set<int> scoped_reach(const std::vector<std::vector<int> >& edges, int start, const QueryScope& scope) {
+    std::set<int> seen;
+    if (!scope.has(start)) {
+        return seen;
+    }
+    std::vector<int> stack(1, start);
+    while (!stack.empty()) {
+        int u = stack.back();
+        stack.pop_back();
+        for (int v : edges[u]) {
+            if (scope.has(v) && seen.insert(v).second) {
+                stack.push_back(v);
+            }
+        }
+    }
+    return seen;
+}
+
+bool run_query_expr(const QueryExpr& node, const NumberedGraph& g, const QueryScope& scope,
+                    const PathLimits& limits, QueryValue& value, std::string& error) {
+    if (node.op == "&" || node.op == "|" || node.op == "-") {
+        QueryValue left, right;
+        if (!run_query_expr(*node.left, g, scope, limits, left, error)) {
+            return false;
+        }
+        QueryScope inner;
+        inner.everything = false;
+        if (node.restrict_right) {
+            inner.nodes.insert(left.nodes.begin(), left.nodes.end());
+        }
+        if (!run_query_expr(*node.right, g, node.restrict_right ? inner : scope, limits, right, error)) {
+            return false;
+        }
+        if (left.is_paths || right.is_paths) {
+            error = "paths cannot be combined with " + node.op;
+            return false;
+        }
+        const std::set<int>& a = left.nodes;
+        const std::set<int>& b = right.nodes;
+        if (node.op == "&") {
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(value.nodes, value.nodes.end()));
+        } else if (node.op == "|") {
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(value.nodes, value.nodes.end()));
+        } else {
+            std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(value.nodes, value.nodes.end()));
+        }
+        return true;
+    }
+
+    std::vector<int> ids;
+    for (const std::string& arg : node.args) {
+        auto it = g.index.find(arg);
+        if (it == g.index.end()) {
+            error = "unknown node " + arg;
+            return false;
+        }
+        ids.push_back(it->second);
+    }
+    if (node.op == "deps" || node.op == "rdeps") {
+        value.nodes = scoped_reach(node.op == "deps" ? g.out : g.in, ids[0], scope);
+    } else if (node.op == "nodes") {
+        for (size_t i = 0; i < g.names.size(); i++) {
+            if (scope.has(i)) {
+                value.nodes.insert(i);
+            }
+        }
+    } else if (node.op == "cycles") {
+        std::vector<int> nodes;
+        std::unordered_set<int> inside;
+        if (scope.everything) {
+            for (size_t i = 0; i < g.names.size(); i++) {
+                nodes.push_back(i);
+            }
+        } else {
+            nodes.assign(scope.nodes.begin(), scope.nodes.end());
+            std::sort(nodes.begin(), nodes.end());
+        }
+        inside.insert(nodes.begin(), nodes.end());
+        for (const std::vector<int>& component : tarjan_scc(nodes, g.out, inside)) {
+            if (is_cyclic_component(component, g.out)) {
+                value.groups.push_back(component);
+                value.nodes.insert(component.begin(), component.end());
+            }
+        }
+    } else {
+        // Hop distances to the target, no further than maxlen
+        int target = ids[1];
+        size_t maxlen = node.maxlen > 0 ? node.maxlen : g.names.size();
+        std::unordered_map<int, size_t> distance;
+        std::vector<int> level(1, target);
+        distance[target] = 0;
+        for (size_t d = 1; d <= maxlen && !level.empty(); d++) {
+            std::vector<int> next;
+            for (int v : level) {
+                for (int u : g.in[v]) {
+                    if (scope.has(u) && distance.insert(std::make_pair(u, d)).second) {
+                        next.push_back(u);
+                    }
+                }
+            }
+            level.swap(next);
+        }
+        value.is_paths = true;
+        if (!distance.count(ids[0]) || !scope.has(ids[0]) || !scope.has(target)) {
+            return true;
+        }
+        std::vector<int> path(1, ids[0]);
+        std::vector<size_t> cursor(1, 0);
+        std::unordered_set<int> on_path(path.begin(), path.end());
+        while (!path.empty()) {
+            int u = path.back();
+            if (u == target && path.size() > 1) {
+                std::vector<std::string> names;
+                for (int p : path) {
+                    names.push_back(g.names[p]);
+                }
+                value.paths.push_back(path_to_string(names));
+                if (limits.max_total_paths > 0 && value.paths.size() >= limits.max_total_paths) {
+                    break;
+                }
+            }
+            bool pushed = false;
+            // The target ends a path, and only the start may be met again, as the target
+            while ((u != target || path.size() == 1) && cursor.back() < g.out[u].size()) {
+                int v = g.out[u][cursor.back()++];
+                auto d = distance.find(v);
+                if (d != distance.end() && path.size() + d->second <= maxlen && (v == target || !on_path.count(v))) {
+                    path.push_back(v);
+                    cursor.push_back(0);
+                    on_path.insert(v);
+                    pushed = true;
+                    break;
+                }
+            }
+            if (!pushed) {
+                on_path.erase(u);
+                path.pop_back();
+                cursor.pop_back();
+            }
+        }
+    }
+    return true;
+}
+
+// Run one query given on the command line; --explain prints the plan first
+int run_select(const DepGraph& graph, const std::vector<std::string>& args, const PathLimits& limits, bool explain) {
+    if (args.size() < 2) {
+        std::cerr << "Usage: select 'deps(X) & rdeps(Y) within prefix(\"net/\")' [--explain]" << std::endl;
+        return 1;
+    }
+    NumberedGraph g = number_graph(graph);
+    QueryParser parser;
+    parser.text = args[1];
+    std::unique_ptr<QueryExpr> query = parser.expr();
+    QueryScope scope;
+    std::string plan;
+    if (parser.error.empty() && parser.peek() == "within") {
+        parser.next();
+        parse_scope(parser, g, scope, plan);
+    }
+    if (parser.error.empty() && !parser.peek().empty()) {
+        parser.error = "unexpected '" + parser.peek() + "'";
+    }
+    if (!parser.error.empty()) {
+        std::cerr << "Bad query: " << parser.error << std::endl;
+        return 1;
+    }
+    plan_query(*query, plan, 0);
+    if (explain) {
+        std::cout << plan;
+    }
+
+    QueryValue value;
+    std::string error;
+    if (!run_query_expr(*query, g, scope, limits, value, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (value.is_paths) {
+        for (const std::string& path : value.paths) {
+            std::cout << path << std::endl;
+        }
+    } else if (query->op == "cycles") {
+        for (const std::vector<int>& group : value.groups) {
+            std::cout << join_sorted_names(group, g.names) << std::endl;
+        }
+    } else {
+        for (int node : value.nodes) {
+            std::cout << g.names[node] << std::endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Usage: main [--input=file] [mode]
+    std::unordered_map<std::string, std::string> options;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            size_t eq = arg.find('=');
+            options[arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2)] =
+                eq == std::string::npos ? "" : arg.substr(eq + 1);
+        } else {
+            args.push_back(arg);
+        }
+    }
+    std::string input = options.count("input") ? options["input"] : "dependencies.txt";
+    std::string mode = args.empty() ? "paths" : args[0];
+
+    // Numeric options, checked before anything is read
+    PathLimits limits;
+    size_t cache_bytes, threads, max_length, max_cycles, k;
+    double explosion_limit;
+    if (!parse_size_option(options, "max-depth", 0, limits.max_depth) ||
+        !parse_size_option(options, "max-paths-per-root", 0, limits.max_paths_per_root) ||
+        !parse_size_option(options, "max-paths", 0, limits.max_total_paths) ||
+        !parse_number_option(options, "time-limit", 0.0, limits.time_budget) ||
+        !parse_number_option(options, "explosion-limit", 0.0, explosion_limit) ||
+        !parse_size_option(options, "cache-bytes", 67108864, cache_bytes) ||
+        !parse_size_option(options, "threads", 0, threads) ||
+        !parse_size_option(options, "max-length", 0, max_length) ||
+        !parse_size_option(options, "max-cycles", 0, max_cycles) ||
+        !parse_size_option(options, "k", 10, k)) {
+        return 1;
+    }
+
+    // Nodes to read: --include=a/,b/ --exclude=a/test --include-regex=... --exclude-regex=...
+    NodeFilter filter;
+    filter.include_prefixes = split_list(options["include"]);
+    filter.exclude_prefixes = split_list(options["exclude"]);
+    std::vector<std::pair<std::string, std::vector<std::regex>*> > patterns = {
+        {"include-regex", &filter.include_patterns}, {"exclude-regex", &filter.exclude_patterns}};
+    for (const auto& option : patterns) {
+        if (options[option.first].empty()) {
+            continue;
+        }
+        try {
+            option.second->push_back(std::regex(options[option.first]));
+        } catch (const std::regex_error& e) {
+            std::cerr << "Bad --" << option.first << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // Saved states are only reused with the same filters
+    std::string filters = options["include"] + "\n" + options["exclude"] + "\n" + options["include-regex"] +
+                          "\n" + options["exclude-regex"];
+    uint64_t filter_hash = checksum(filters.data(), filters.size());
+
+    // Modes that read their own files
+    std::string socket_path = options.count("socket") ? options["socket"] : "graph_search.sock";
+    if (mode == "diff") {
+        return run_diff(args, limits, filter);
+    }
+    if (mode == "query") {
+        return run_query(socket_path, args);
+    }
+    if (mode == "daemon") {
+        // --snapshot=file restores the state when the file matches the input,
+        // and is written otherwise
+        std::string snapshot = options["snapshot"];
+        AnalysisState state;
+        if (!snapshot.empty() && load_snapshot(snapshot, source_stamp(input), filter_hash, state)) {
+            std::cout << "Restored version " << state.version << " from " << snapshot << std::endl;
+        } else {
+            if (!read_dependencies(input, state.graph, filter)) {
+                std::cerr << "Cannot open " << input << std::endl;
+                return 1;
+            }
+            build_adj_list(state.graph);
+            build_state(state);
+            if (!snapshot.empty()) {
+                save_snapshot(state, snapshot, source_stamp(input), filter_hash);
+            }
+        }
+        // Path queries on a node that reaches a large cycle never end without
+        // limits, so the daemon has its own unless they are given
+        PathLimits query_limits = limits;
+        if (!options.count("max-paths")) {
+            query_limits.max_total_paths = 10000;
+        }
+        if (!options.count("time-limit")) {
+            query_limits.time_budget = 5.0;
+        }
+        return run_daemon(state, socket_path, query_limits, cache_bytes,
+                          options.count("watch") ? input : "", filter, snapshot, filter_hash);
+    }
+
+    DepGraph graph;
+    if (!read_dependencies(input, graph, filter)) {
+        std::cerr << "Cannot open " << input << std::endl;
+        return 1;
+    }
+    build_adj_list(graph);
+
+    if (mode == "paths") {
+        // Check the size of the output first if a threshold is given
+        if (options.count("explosion-limit")) {
+            PathEstimate est = estimate_paths(graph, limits.max_depth);
+            if (!est.bounded || est.paths > explosion_limit) {
+                if (options["on-explosion"] == "summary") {
+                    print_estimate(est, true);
+                    return 0;
+                }
+                print_estimate(est, false);
+                std::cerr << "Refusing to enumerate, the estimate is over --explosion-limit" << std::endl;
+                return 2;
+            }
+        }
+        // Roots are cached by subgraph hash, unless a global limit makes their
+        // paths depend on the roots before them
+        if (options.count("cache-dir")) {
+            if (limits.max_total_paths > 0 || limits.time_budget > 0) {
+                std::cerr << "--cache-dir is not used with --max-paths or --time-limit" << std::endl;
+                return run_paths(graph, limits);
+            }
+            PathCache cache;
+            cache.directory = options["cache-dir"];
+            ::mkdir(cache.directory.c_str(), 0755);
+            NumberedGraph g = number_graph(graph);
+            std::vector<uint64_t> hashes = subgraph_hashes(g);
+            for (const auto& node : graph.adj_list) {
+                std::string key(reinterpret_cast<const char*>(&hashes[g.index[node.first]]), sizeof(uint64_t));
+                key += " " + std::to_string(limits.max_depth) + " " + std::to_string(limits.max_paths_per_root);
+                cache.keys[node.first] = checksum(key.data(), key.size());
+            }
+            int status = run_paths(graph, limits, &cache);
+            std::cerr << "Path cache: " << cache.hits << " roots loaded, " << cache.misses << " searched" << std::endl;
+            return status;
+        }
+        return run_paths(graph, limits);
+    }
+    if (mode == "critical") {
+        return run_critical(graph);
+    }
+    if (mode == "why") {
+        return run_why(graph, args, options.count("all") > 0);
+    }
+    if (mode == "estimate") {
+        return run_estimate(graph, limits.max_depth);
+    }
+    if (mode == "incremental") {
+        return run_incremental(graph);
+    }
+    if (mode == "scc") {
+        return run_scc(graph, options["updates"]);
+    }
+    if (mode == "feedback") {
+        return run_feedback(graph, threads);
+    }
+    if (mode == "dominators") {
+        return run_dominators(graph, args);
+    }
+    if (mode == "cycles-through") {
+        return run_cycles_through(graph, args, max_length, max_cycles);
+    }
+    if (mode == "k-paths") {
+        return run_k_paths(graph, args, k);
+    }
+    if (mode == "take") {
+        return run_take(graph, args);
+    }
+    if (mode == "batch") {
+        return run_batch(graph, args, limits);
+    }
+    if (mode == "summary") {
+        return run_summary(graph, args);
+    }
+    if (mode == "reanalyze") {
+        return run_reanalyze(graph, options.count("state") ? options["state"] : "graph_search.state",
+                             source_stamp(input), filter_hash);
+    }
+    if (mode == "select") {
+        return run_select(graph, args, limits, options.count("explain") > 0);
+    }
+    std::cerr << "Unknown mode: " << mode << std::endl;
+    return 1;
+}
@@ -0,0 +1,435 @@
+#!/bin/sh
+# Regression tests: build graph_search and compare its output on small inputs.
+# Run from anywhere: sh tests/run_tests.sh
+set -u
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -std=c++20 -O2 -pthread "$root/main_cleaned.cpp" -o "$work/graph_search" || exit 1
+
+failed=0
+
+# check NAME EXPECTED INPUT MODE... : run MODE on INPUT and compare stdout
+check() {
+    name=$1
+    expected=$2
+    printf '%s\n' "$3" > "$work/input.txt"
+    shift 3
+    actual=$("$work/graph_search" --input="$work/input.txt" "$@" 2>&1)
+    if [ "$actual" = "$expected" ]; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        echo "  expected: $expected"
+        echo "  actual:   $actual"
+        failed=1
+    fi
+}
+
+# A node downstream of a cycle is still reached acyclically from R
+check critical_after_cycle "Critical path per root:
+[101] R -> X -> Y
+Nodes left out (on a cycle): 2" "C1 -> C2
+C2 -> C1
+C1 -> X
+R -> X
+X -> Y 100
+R -> Z 2" critical
+
+check why_shortest "Shortest chains (length 1): 1
+A -> D" "A -> B 1
+B -> D 1
+A -> C 1
+C -> D 2
+A -> D 5" why A D
+
+# Paths cut by a limit are marked and the last line names the limit
+check limit_depth "Paths found: 4
+No circular dependency
+B -> C
+D -> C
+A -> B [truncated]
+A -> D [truncated]
+Circular dependeny detected:
+Output is incomplete, limits reached: max depth;" "A -> B
+B -> C
+A -> D
+D -> C" paths --max-depth=1
+
+check limit_paths_per_root "Paths found: 3
+No circular dependency
+B -> C
+D -> C
+A -> B -> C
+Circular dependeny detected:
+Output is incomplete, limits reached: max paths per root;" "A -> B
+B -> C
+A -> D
+D -> C" paths --max-paths-per-root=1
+
+check limit_bad_value "Invalid --max-depth: x" "A -> B" paths --max-depth=x
+
+check estimate_acyclic "Estimated paths: 4 (exact)
+Estimated output bytes: 38 (exact)
+Estimated peak memory bytes: 586 (exact)
+Paths per root:
+A 2
+B 1
+D 1" "A -> B
+B -> C
+A -> D
+D -> C" estimate
+
+# estimate_bound NAME INPUT OPTION... : the estimate is never below the
+# number of paths that the same limits let through
+estimate_bound() {
+    name=$1
+    printf '%s\n' "$2" > "$work/input.txt"
+    shift 2
+    estimated=$("$work/graph_search" --input="$work/input.txt" estimate "$@" | sed -n 's/^Estimated paths: \([0-9]*\) .*/\1/p')
+    found=$("$work/graph_search" --input="$work/input.txt" paths "$@" | sed -n 's/^Paths found: //p')
+    if [ -n "$estimated" ] && [ -n "$found" ] && [ "$estimated" -ge "$found" ]; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        echo "  estimated: $estimated, found: $found"
+        failed=1
+    fi
+}
+
+chain="A -> B
+B -> C
+C -> D
+D -> E
+E -> F
+F -> G
+G -> H"
+estimate_bound estimate_chain "$chain"
+estimate_bound estimate_chain_depth "$chain" --max-depth=2
+estimate_bound estimate_cycle_depth "A -> B
+B -> C
+C -> A
+C -> D
+D -> B
+A -> E" --max-depth=2
+
+check incremental_cycles "Edge C -> A closes a cycle: C -> A -> B -> C
+Edge D -> B closes a cycle: D -> B -> C -> D
+Edges added: 3, closing a cycle: 2" "A -> B
+B -> C
+C -> A
+C -> D
+D -> B" incremental
+
+printf '+ C -> A\n- C -> A\n' > "$work/updates.txt"
+check scc_updates "Circular components:
+After + C -> A:
+  merged #2 #3 into #4
+  #4 {A C}
+After - C -> A:
+  split #4 into #5 #6" "A -> B 1
+B -> D 1
+A -> C 1
+C -> D 2
+A -> D 5" scc --updates="$work/updates.txt"
+
+printf '* A -> B\n' > "$work/updates.txt"
+check scc_bad_update "Circular components:
+$work/updates.txt:1: unknown update '*', expected + or -" "A -> B" scc --updates="$work/updates.txt"
+
+check feedback_arcs "Edges to remove: 1 in 1 circular components
+[2 cycles] B -> C" "A -> B
+B -> C
+C -> A
+C -> D
+D -> B" feedback
+
+check dominators_roots "Dominators from (root) (6 nodes reached):
+A <- (root) (dominates 5)
+D <- A (dominates 2)
+E <- D (dominates 1)
+B <- A (dominates 1)
+F <- E (dominates 0)
+C <- B (dominates 0)" "A -> B
+B -> C
+C -> B
+A -> D 3
+D -> E
+E -> F" dominators
+
+check cycles_through "Cycles through B: 2
+B -> C -> A -> B
+B -> C -> D -> B" "A -> B
+B -> C
+C -> A
+C -> D
+D -> B" cycles-through B
+
+check cycles_through_short "Cycles through B: 0" "A -> B
+B -> C
+C -> A
+C -> D
+D -> B" cycles-through B --max-length=2
+
+check k_paths "Cheapest chains from A to D: 2
+[2] A -> B -> D
+[3] A -> C -> D" "A -> B 1
+B -> D 1
+A -> C 1
+C -> D 2
+A -> D 5" k-paths A D --k=2
+
+check k_paths_zero "Invalid --k: 0" "A -> B" k-paths A B --k=0
+
+printf 'A -> B\nB -> C\nC -> B\n' > "$work/old.txt"
+printf 'A -> B\nB -> C\nC -> D\n' > "$work/new.txt"
+check diff_files "Edges added: 1
++ C -> D
+Edges removed: 1
+- C -> B
+Circular components new or changed: 0
+Circular components gone or changed: 1
+{B C}
+Paths added: 2
++ A -> B -> C -> D
++ B -> C -> D
+Paths removed: 2
+- A -> B -> C -> B
+- B -> C -> B" "" diff "$work/old.txt" "$work/new.txt"
+
+check filter_exclude "Paths found: 2
+No circular dependency
+B -> C
+A -> B -> C
+Circular dependeny detected:
+Output is complete" "A -> B
+B -> C
+A -> D
+D -> C" paths --exclude=D
+
+check filter_include_regex "Paths found: 1
+No circular dependency
+A -> B
+Circular dependeny detected:
+Output is complete" "A -> B
+B -> C
+A -> D
+D -> C" paths --include-regex='^[AB]'
+
+# The loop found from C is listed from its smallest node
+check dedup_rotation "Paths found: 1
+No circular dependency
+Circular dependeny detected:
+A -> C -> B -> A (1 occurrence)
+Output is complete" "C -> B
+B -> A
+A -> C" paths
+
+check take_first "B -> C
+D -> C" "A -> B
+B -> C
+A -> D
+D -> C" take 2
+
+# start_daemon OPTION... : serve $work/daemon.txt on $work/daemon.sock
+start_daemon() {
+    rm -f "$work/daemon.sock"
+    "$work/graph_search" --input="$work/daemon.txt" daemon --socket="$work/daemon.sock" "$@" > "$work/daemon.log" 2>&1 &
+    daemon=$!
+    tries=0
+    while [ ! -S "$work/daemon.sock" ] && [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+}
+stop_daemon() {
+    kill "$daemon"
+    wait "$daemon" 2>/dev/null
+}
+query() {
+    "$work/graph_search" query "$@" --socket="$work/daemon.sock" 2>&1
+}
+
+# expect NAME EXPECTED ACTUAL
+expect() {
+    if [ "$3" = "$2" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        echo "  expected: $2"
+        echo "  actual:   $3"
+        failed=1
+    fi
+}
+
+printf 'A -> B\nB -> C\nC -> B\nA -> D\nD -> E\n' > "$work/daemon.txt"
+start_daemon
+expect daemon_depends_on "1" "$(query depends-on A E)"
+expect daemon_deps "B C D E" "$(query deps A | sort | tr '\n' ' ' | sed 's/ $//')"
+expect daemon_cycles "B C" "$(query cycles)"
+expect daemon_paths_from "D -> E" "$(query paths-from D)"
+expect daemon_unknown_node "bad arguments" "$(query deps Z)"
+stop_daemon
+
+# Queries that enumerate paths stop at the daemon's limits
+printf 'A -> B\nB -> C\nC -> D\nC -> E\nD -> E\nE -> C\n' > "$work/daemon.txt"
+start_daemon --max-paths=1
+expect daemon_path_limit "query limit reached: max total paths" "$(query path-count A)"
+expect daemon_paths_below_limit "A -> B -> C -> D -> E -> C" "$(query paths-from A 1)"
+stop_daemon
+
+# The second identical query is answered from the cache
+printf 'A -> B\nB -> C\n' > "$work/daemon.txt"
+start_daemon
+query deps A > /dev/null
+query deps A > /dev/null
+expect cache_hit "version 0
+cache hits 1
+cache misses 1
+cache entries 1" "$(query stats | grep -v bytes)"
+stop_daemon
+
+# wait_for NAME EXPECTED QUERY... : repeat QUERY until it gives EXPECTED
+wait_for() {
+    name=$1
+    expected=$2
+    shift 2
+    tries=0
+    while [ "$(query "$@")" != "$expected" ] && [ $tries -lt 50 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    expect "$name" "$expected" "$(query "$@")"
+}
+
+printf 'A -> B\nB -> C\n' > "$work/daemon.txt"
+start_daemon --watch
+expect watch_before "0" "$(query depends-on C A)"
+printf 'A -> B\nB -> C\nC -> A\n' > "$work/daemon.new"
+mv "$work/daemon.new" "$work/daemon.txt"
+wait_for watch_after_rename "1" depends-on C A
+printf 'A -> B\nB -> C\n' > "$work/daemon.txt"
+wait_for watch_after_write "0" depends-on C A
+stop_daemon
+
+# A restarted daemon restores the snapshot and gives the same answers
+printf 'A -> B\nB -> C\nC -> B\nA -> D\nD -> E\n' > "$work/daemon.txt"
+daemon_answers() {
+    for node in A B C D E; do
+        query deps "$node" | sort
+        query rdeps "$node" | sort
+        query path-count "$node"
+    done
+    query cycles
+}
+start_daemon --snapshot="$work/snapshot"
+computed=$(daemon_answers)
+stop_daemon
+start_daemon --snapshot="$work/snapshot"
+expect snapshot_restored "Restored version 0 from $work/snapshot" "$(grep Restored "$work/daemon.log")"
+expect snapshot_same_answers "$computed" "$(daemon_answers)"
+stop_daemon
+
+tab=$(printf '\t')
+printf 'depends-on A E\ndeps D\npaths-from A 1\ndepends-on A E\nfoo A\n' > "$work/queries.txt"
+check batch_queries "depends-on A E:${tab}1
+deps D:${tab}E
+paths-from A 1:${tab}A -> B -> C -> B
+depends-on A E:${tab}1
+foo A:${tab}error:${tab}unknown query" "A -> B
+B -> C
+C -> B
+A -> D
+D -> E" batch "$work/queries.txt"
+
+# After an update only the new version's answers stay cached
+printf 'A -> B\nB -> C\n' > "$work/daemon.txt"
+start_daemon --watch
+query deps A > /dev/null
+printf 'A -> B\nB -> C\nC -> D\n' > "$work/daemon.txt"
+wait_for update_deps "B
+C
+D" deps A
+expect update_cache "version 1
+cache entries 1" "$(query stats | grep -e version -e entries)"
+stop_daemon
+
+check summary_roots "E: 1 paths, depth 1
+B: reaches a cycle, depth 0
+D: 1 paths, depth 2
+A: reaches a cycle, depth 3
+Roots: 4, reaching a cycle: 2
+Paths from the roots without cycles: 2
+Maximum depth: 3" "A -> B
+B -> C
+C -> B
+A -> D 3
+D -> E
+E -> F" summary
+
+check summary_node "D: 1 paths, depth 2" "A -> B
+D -> E
+E -> F" summary D
+
+# reanalyze FILE STATE: the report of a reanalysis without its timing
+reanalyze() {
+    "$work/graph_search" --input="$1" reanalyze --state="$2" 2>&1 | sed 's/ in [0-9.e+-]* s$//'
+}
+
+# A state carried through an edit answers the next edit like a fresh one
+printf 'A -> B\nB -> C\nA -> D\nD -> C\n' > "$work/edit.txt"
+reanalyze "$work/edit.txt" "$work/carried.state" > /dev/null
+printf 'A -> B\nB -> C\nC -> B\nA -> D\nE -> D\n' > "$work/edit.txt"
+expect reanalyze_edit "Changed edges: 2 added, 1 removed
+Re-analysed 5 of 5 nodes
+New circular component: B C
+Root A: 2 paths -> reaches a cycle
+New root E: 1 paths" "$(reanalyze "$work/edit.txt" "$work/carried.state")"
+reanalyze "$work/edit.txt" "$work/fresh.state" > /dev/null
+printf 'A -> B\nB -> C\nA -> D\nE -> D\nD -> F\n' > "$work/edit.txt"
+expect reanalyze_equivalent "$(reanalyze "$work/edit.txt" "$work/fresh.state")" "$(reanalyze "$work/edit.txt" "$work/carried.state")"
+
+check select_plan "& (right side searched inside the left result)
+  deps(A) forward search
+  rdeps(C) backward search
+B
+D" "A -> B
+B -> C
+A -> D
+D -> C" select 'deps(A) & rdeps(C)' --explain
+
+check select_path "A -> D -> C" "A -> B
+B -> C
+A -> D
+D -> C" select 'path(A, C) within regex("^[ACD]$")'
+
+# A second run reads every root back from the cache and prints the same paths
+printf 'A -> B\nB -> C\nC -> B\nA -> D\nD -> E\n' > "$work/input.txt"
+uncached=$("$work/graph_search" --input="$work/input.txt" paths 2>&1)
+"$work/graph_search" --input="$work/input.txt" paths --cache-dir="$work/cache" > /dev/null 2>&1
+cached=$("$work/graph_search" --input="$work/input.txt" paths --cache-dir="$work/cache" 2>&1)
+expect cache_dir_loaded "Path cache: 3 roots loaded, 0 searched" "$(echo "$cached" | grep '^Path cache')"
+expect cache_dir_same_paths "$uncached" "$(echo "$cached" | grep -v '^Path cache')"
+
+g++ -std=c++17 -O2 "$root/generate_dep.cpp" -o "$work/generate_dep" || exit 1
+
+# generate OPTION... : the edges written to stdout
+generate() {
+    "$work/generate_dep" --output=- "$@" 2> /dev/null
+}
+
+expect generator_default_small "6" "$(generate --nodes=3 | wc -l | tr -d ' ')"
+expect generator_er_distinct "12" "$(generate --nodes=4 --edges=12 | sort -u | wc -l | tr -d ' ')"
+expect generator_seeded "$(generate --model=powerlaw --nodes=50 --seed=3)" "$(generate --model=powerlaw --nodes=50 --seed=3)"
+expect generator_bad_edges "Need 2 <= --nodes < 2^32, --edges <= nodes * (nodes - 1), --alpha > 2, 0 <= --density <= 1, --max-weight <= 2^53 and --name-width <= 40" \
+    "$("$work/generate_dep" --nodes=3 --edges=7 --output=- 2>&1)"
+
+# The binary edge list reads back as the same graph as the text one
+"$work/generate_dep" --model=scc --nodes=60 --seed=5 --output="$work/gen.txt" 2> /dev/null
+"$work/generate_dep" --model=scc --nodes=60 --seed=5 --format=binary --output="$work/gen.bin" 2> /dev/null
+expect generator_binary "$("$work/graph_search" --input="$work/gen.txt" summary 2>&1)" \
+    "$("$work/graph_search" --input="$work/gen.bin" summary 2>&1)"
+
+exit $failed